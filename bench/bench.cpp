@@ -0,0 +1,443 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <chrono>
+#include <filesystem>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <unistd.h>
+#include "../mystl/vector.hpp"
+#include "../mystl/hashmap.hpp"
+#include "../libir/text.hpp"
+#include "../libir/codec.hpp"
+#include "../libir/setops.hpp"
+
+namespace fs = std::filesystem;
+using mystl::Vector;
+using namespace ir;
+
+// Allocation counting: operator new is replaced here, and malloc/realloc/calloc
+// calls made by this binary and libir are redirected through the linker
+// (-Wl,--wrap, see the Makefile), which catches mystl::Vector's realloc growth.
+static uint64_t g_allocs = 0;
+static uint64_t g_alloc_bytes = 0;
+// Results are folded in here so the optimizer cannot drop the measured work.
+static volatile uint64_t g_sink = 0;
+
+extern "C" {
+void* __real_malloc(size_t n);
+void* __real_realloc(void* p, size_t n);
+void* __real_calloc(size_t k, size_t n);
+
+void* __wrap_malloc(size_t n) { ++g_allocs; g_alloc_bytes += n; return __real_malloc(n); }
+void* __wrap_realloc(void* p, size_t n) { ++g_allocs; g_alloc_bytes += n; return __real_realloc(p, n); }
+void* __wrap_calloc(size_t k, size_t n) { ++g_allocs; g_alloc_bytes += k * n; return __real_calloc(k, n); }
+}
+
+void* operator new(size_t n) {
+    ++g_allocs;
+    g_alloc_bytes += n;
+    void* p = __real_malloc(n ? n : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+struct Result {
+    std::string name;
+    std::string unit;
+    uint64_t ops = 0;
+    uint64_t bytes = 0;
+    double seconds = 0;
+    Vector<double> sample_ns;
+    double p50_ns = 0;
+    double p99_ns = 0;
+    bool counted = true;
+    uint64_t allocs = 0;
+    uint64_t alloc_bytes = 0;
+    bool skipped = false;
+};
+
+static double percentile(Vector<double> v, double p) {
+    if (v.empty()) return 0.0;
+    std::sort(v.data(), v.data() + v.size());
+    return v[(size_t)(p * (double)(v.size() - 1))];
+}
+
+// Times `samples` calls of fn(bytes) after one warm-up call; fn returns how many
+// ops it performed, and latency percentiles are per op within a sample.
+template <class Fn>
+static Result run_micro(const char* name, const char* unit, size_t samples, Fn fn) {
+    Result r;
+    r.name = name;
+    r.unit = unit;
+    r.sample_ns.reserve(samples);
+    uint64_t scratch = 0;
+    fn(scratch);
+    uint64_t a0 = g_allocs, b0 = g_alloc_bytes;
+    for (size_t s = 0; s < samples; ++s) {
+        uint64_t bytes = 0;
+        auto t0 = std::chrono::steady_clock::now();
+        uint64_t ops = fn(bytes);
+        double dt = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        r.ops += ops;
+        r.bytes += bytes;
+        r.seconds += dt;
+        r.sample_ns.push_back(ops ? dt * 1e9 / (double)ops : 0.0);
+    }
+    r.allocs = g_allocs - a0;
+    r.alloc_bytes = g_alloc_bytes - b0;
+    r.p50_ns = percentile(r.sample_ns, 0.50);
+    r.p99_ns = percentile(r.sample_ns, 0.99);
+    return r;
+}
+
+// Deterministic synthetic text: a Zipf-like pick from generated words that carry
+// the suffixes the stemmer strips, with capitals and punctuation mixed in.
+struct TextGen {
+    uint64_t state = 88172645463325252ULL;
+    Vector<std::string> vocab;
+
+    uint32_t next() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return (uint32_t)(state >> 16);
+    }
+
+    TextGen() {
+        static const char* suffixes[] = {"", "", "s", "es", "ing", "ed", "ly", "ation", "ness", "ment", "er"};
+        for (int i = 0; i < 8000; ++i) {
+            std::string w;
+            size_t len = 2 + next() % 8;
+            for (size_t k = 0; k < len; ++k) w += (char)('a' + next() % 26);
+            w += suffixes[next() % (sizeof(suffixes) / sizeof(suffixes[0]))];
+            vocab.push_back(w);
+        }
+    }
+
+    const std::string& word() {
+        double u = (double)(next() % 1000000) / 1000000.0;
+        return vocab[(size_t)(u * u * u * (double)(vocab.size() - 1))];
+    }
+
+    std::string line() {
+        std::string s;
+        size_t n = 10 + next() % 15;
+        for (size_t i = 0; i < n; ++i) {
+            std::string w = word();
+            if (next() % 8 == 0) w[0] = (char)(w[0] - 'a' + 'A');
+            s += w;
+            uint32_t p = next() % 10;
+            s += (p == 0) ? ", " : (p == 1) ? ". " : (p == 2) ? " - " : " ";
+        }
+        return s;
+    }
+
+    // Sorted distinct ids below `universe`, about n of them.
+    Vector<uint32_t> ids(size_t n, uint32_t universe) {
+        Vector<uint32_t> v;
+        uint32_t gap = universe / (uint32_t)n;
+        uint32_t x = 0;
+        for (size_t i = 0; i < n; ++i) {
+            x += 1 + next() % (2 * gap);
+            if (x >= universe) break;
+            v.push_back(x);
+        }
+        return v;
+    }
+};
+
+static std::string json_num(double x) {
+    char buf[64];
+    std::snprintf(buf, sizeof(buf), "%.6g", x);
+    return buf;
+}
+
+static void print_json(const Vector<Result>& results) {
+    std::cout << "{\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        std::cout << "    {\"name\": \"" << r.name << "\", \"unit\": \"" << r.unit << "\"";
+        if (r.skipped) {
+            std::cout << ", \"skipped\": true}";
+        } else {
+            double ops = (double)(r.ops ? r.ops : 1);
+            std::cout << ", \"ops\": " << r.ops
+                      << ", \"seconds\": " << json_num(r.seconds)
+                      << ", \"ops_per_s\": " << json_num(r.seconds > 0 ? (double)r.ops / r.seconds : 0.0)
+                      << ", \"mb_per_s\": " << (r.bytes ? json_num((double)r.bytes / 1048576.0 / r.seconds) : "null")
+                      << ", \"p50_ns\": " << json_num(r.p50_ns)
+                      << ", \"p99_ns\": " << json_num(r.p99_ns);
+            if (r.counted) {
+                std::cout << ", \"allocs_per_op\": " << json_num((double)r.allocs / ops)
+                          << ", \"alloc_bytes_per_op\": " << json_num((double)r.alloc_bytes / ops) << "}";
+            } else {
+                std::cout << ", \"allocs_per_op\": null, \"alloc_bytes_per_op\": null}";
+            }
+        }
+        std::cout << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    std::cout << "  ]\n}\n";
+}
+
+static void micro(Vector<Result>& out, size_t scale) {
+    TextGen gen;
+
+    Vector<std::string> lines;
+    for (int i = 0; i < 256; ++i) lines.push_back(gen.line());
+    Vector<std::string> toks;
+    toks.reserve(64);
+    out.push_back(run_micro("tokenize_line", "token", 40 * scale, [&](uint64_t& bytes) {
+        uint64_t n = 0;
+        for (size_t i = 0; i < lines.size(); ++i) {
+            toks.clear();
+            tokenize_line(lines[i], toks);
+            n += toks.size();
+            bytes += lines[i].size();
+        }
+        return n;
+    }));
+
+    Vector<std::string> words, work;
+    for (int i = 0; i < 4096; ++i) words.push_back(gen.word());
+    work = words;
+    out.push_back(run_micro("stem_inplace", "word", 40 * scale, [&](uint64_t& bytes) {
+        for (size_t i = 0; i < words.size(); ++i) {
+            work[i].assign(words[i]);
+            stem_inplace(work[i]);
+            bytes += words[i].size();
+        }
+        return (uint64_t)words.size();
+    }));
+    out.push_back(run_micro("porter_stem_inplace", "word", 40 * scale, [&](uint64_t& bytes) {
+        for (size_t i = 0; i < words.size(); ++i) {
+            work[i].assign(words[i]);
+            porter_stem_inplace(work[i]);
+            bytes += words[i].size();
+        }
+        return (uint64_t)words.size();
+    }));
+
+    Vector<std::string> keys;
+    for (int i = 0; i < 20000; ++i) keys.push_back(gen.word() + std::to_string(i));
+    out.push_back(run_micro("hashmap_insert", "key", 10 * scale, [&](uint64_t&) {
+        mystl::HashMap<uint32_t> m;
+        for (size_t i = 0; i < keys.size(); ++i) m.get_or_insert(keys[i], 0) = (uint32_t)i;
+        return (uint64_t)keys.size();
+    }));
+
+    mystl::HashMap<uint32_t> built;
+    for (size_t i = 0; i < keys.size(); i += 2) built.get_or_insert(keys[i], 0) = (uint32_t)i;
+    out.push_back(run_micro("hashmap_find", "lookup", 10 * scale, [&](uint64_t&) {
+        uint64_t found = 0;
+        for (size_t i = 0; i < keys.size(); ++i) found += built.find(keys[i]) != nullptr;
+        g_sink = g_sink + found;
+        return (uint64_t)keys.size();
+    }));
+
+    Vector<uint32_t> docs = gen.ids(100000, 2000000);
+    std::string enc;
+    enc.reserve(5 * docs.size());
+    out.push_back(run_micro("varint_encode", "value", 20 * scale, [&](uint64_t& bytes) {
+        enc.clear();
+        uint32_t prev = 0;
+        for (size_t i = 0; i < docs.size(); ++i) {
+            write_varint(enc, docs[i] - prev);
+            prev = docs[i];
+        }
+        bytes += enc.size();
+        return (uint64_t)docs.size();
+    }));
+
+    Vector<uint32_t> dec;
+    dec.resize(docs.size());
+    out.push_back(run_micro("varint_decode", "value", 20 * scale, [&](uint64_t& bytes) {
+        const uint8_t* p = (const uint8_t*)enc.data();
+        const uint8_t* end = p + enc.size();
+        uint32_t prev = 0;
+        size_t n = 0;
+        while (p < end) {
+            prev += read_varint(p, end);
+            dec[n++] = prev;
+        }
+        bytes += enc.size();
+        return (uint64_t)n;
+    }));
+
+    std::string packed;
+    encode_postings(docs, 2000000, CODEC_BP128, packed);
+    out.push_back(run_micro("postings_encode_bp128", "posting", 20 * scale, [&](uint64_t& bytes) {
+        encode_postings(docs, 2000000, CODEC_BP128, packed);
+        bytes += packed.size();
+        return (uint64_t)docs.size();
+    }));
+
+    Vector<uint32_t> unpacked;
+    out.push_back(run_micro("postings_decode_bp128", "posting", 20 * scale, [&](uint64_t& bytes) {
+        const uint8_t* p = (const uint8_t*)packed.data();
+        unpacked.clear();
+        decode_postings(p, p + packed.size(), (uint32_t)docs.size(), POSTINGS_VERSION, CODEC_BP128, 0, unpacked);
+        bytes += packed.size();
+        return (uint64_t)unpacked.size();
+    }));
+
+    Vector<uint32_t> a = gen.ids(100000, 2000000), b = gen.ids(20000, 2000000), c = gen.ids(100000, 2000000);
+    out.push_back(run_micro("intersect_sorted_skewed", "input id", 20 * scale, [&](uint64_t&) {
+        Vector<uint32_t> r = intersect_sorted(a, b);
+        g_sink = g_sink + r.size();
+        return (uint64_t)(a.size() + b.size());
+    }));
+    out.push_back(run_micro("intersect_sorted_equal", "input id", 20 * scale, [&](uint64_t&) {
+        Vector<uint32_t> r = intersect_sorted(a, c);
+        g_sink = g_sink + r.size();
+        return (uint64_t)(a.size() + c.size());
+    }));
+    out.push_back(run_micro("union_sorted", "input id", 20 * scale, [&](uint64_t&) {
+        Vector<uint32_t> r = union_sorted(a, c);
+        g_sink = g_sink + r.size();
+        return (uint64_t)(a.size() + c.size());
+    }));
+
+    Vector< Vector<uint32_t> > many;
+    Vector<const Vector<uint32_t>*> ptrs;
+    size_t total = 0;
+    for (int i = 0; i < 16; ++i) many.push_back(gen.ids(20000, 2000000));
+    for (size_t i = 0; i < many.size(); ++i) { ptrs.push_back(&many[i]); total += many[i].size(); }
+    out.push_back(run_micro("union_k_16", "input id", 20 * scale, [&](uint64_t&) {
+        Vector<uint32_t> r = union_k(ptrs);
+        g_sink = g_sink + r.size();
+        return (uint64_t)total;
+    }));
+}
+
+// Runs a command and returns what it wrote (stdout, or 2>&1 redirections in cmd).
+static bool run_capture(const std::string& cmd, std::string& out) {
+    FILE* f = ::popen(cmd.c_str(), "r");
+    if (!f) return false;
+    char buf[4096];
+    size_t n;
+    out.clear();
+    while ((n = std::fread(buf, 1, sizeof(buf), f)) > 0) out.append(buf, n);
+    return ::pclose(f) == 0;
+}
+
+static double field(const std::string& text, const std::string& name) {
+    size_t at = text.find(name);
+    if (at == std::string::npos) return 0.0;
+    return std::strtod(text.c_str() + at + name.size(), nullptr);
+}
+
+// Whole-program runs of the real tools: index build over the corpus, then a
+// replay of the query set through boolsearch --queries (its own latency summary).
+static void macro(Vector<Result>& out, const std::string& bin_dir, const std::string& corpus,
+                  const std::string& queries, size_t runs) {
+    uint64_t corpus_bytes = 0, n_docs = 0;
+    for (auto src : {"wikipedia_en", "marinelink"}) {
+        fs::path p = fs::path(corpus) / src;
+        if (!fs::exists(p)) continue;
+        for (auto& e : fs::directory_iterator(p)) {
+            if (!e.is_regular_file() || e.path().extension() != ".txt") continue;
+            corpus_bytes += (uint64_t)e.file_size();
+            ++n_docs;
+        }
+    }
+    const char* names[] = {"index_build", "query_replay_exact", "query_replay_estimate", "query_replay_bm25"};
+    if (!n_docs) {
+        for (size_t i = 0; i < 4; ++i) {
+            Result r;
+            r.name = names[i];
+            r.unit = i ? "query" : "document";
+            r.skipped = true;
+            out.push_back(r);
+        }
+        return;
+    }
+
+    fs::path tmp = fs::temp_directory_path() / ("boolbench_" + std::to_string((long)::getpid()));
+    std::string out_dir = tmp.string();
+    Result build;
+    build.name = names[0];
+    build.unit = "document";
+    build.counted = false;
+    for (size_t i = 0; i < runs; ++i) {
+        std::string text;
+        auto t0 = std::chrono::steady_clock::now();
+        bool ok = run_capture(bin_dir + "/lab7/boolindex.exe --input_dir '" + corpus + "' --out_dir '" + out_dir + "'", text);
+        double dt = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        if (!ok) { std::cerr << "boolindex failed\n"; build.skipped = true; break; }
+        build.ops += n_docs;
+        build.bytes += corpus_bytes;
+        build.seconds += dt;
+        build.sample_ns.push_back(dt * 1e9 / (double)n_docs);
+    }
+    build.p50_ns = percentile(build.sample_ns, 0.50);
+    build.p99_ns = percentile(build.sample_ns, 0.99);
+    out.push_back(build);
+
+    // The query set is replayed several times so percentiles rest on more samples.
+    std::string replay = (tmp / "queries.txt").string();
+    {
+        std::ifstream in(queries, std::ios::binary);
+        std::string all((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        std::ofstream rep(replay, std::ios::binary);
+        for (size_t i = 0; i < 20; ++i) rep << all;
+    }
+    const char* modes[] = {"", " --count estimate", " --rank bm25"};
+    for (size_t m = 0; m < 3; ++m) {
+        Result r;
+        r.name = names[1 + m];
+        r.unit = "query";
+        r.counted = false;
+        std::string text;
+        std::string cmd = bin_dir + "/lab8/boolsearch.exe --index_dir '" + out_dir + "/index' --queries '" + replay +
+                          "' --cache_mb 0" + modes[m] + " 2>&1 >/dev/null";
+        if (build.skipped || !run_capture(cmd, text)) {
+            r.skipped = true;
+        } else {
+            r.ops = (uint64_t)field(text, "queries: ");
+            r.seconds = field(text, "wall_s: ");
+            r.p50_ns = field(text, "p50: ") * 1e3;
+            r.p99_ns = field(text, "p99: ") * 1e3;
+        }
+        out.push_back(r);
+    }
+    fs::remove_all(tmp);
+}
+
+static void usage() {
+    std::cout << "Usage: bench [--corpus data_text] [--queries bench/queries.txt] [--bin_dir .] [--scale N] [--runs N] [--micro_only]\n";
+}
+
+int main(int argc, char** argv) {
+    std::string corpus = "data_text";
+    std::string queries = "bench/queries.txt";
+    std::string bin_dir = ".";
+    size_t scale = 5;
+    size_t runs = 3;
+    bool micro_only = false;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--corpus" && i + 1 < argc) corpus = argv[++i];
+        else if (a == "--queries" && i + 1 < argc) queries = argv[++i];
+        else if (a == "--bin_dir" && i + 1 < argc) bin_dir = argv[++i];
+        else if (a == "--scale" && i + 1 < argc) scale = (size_t)std::stoul(argv[++i]);
+        else if (a == "--runs" && i + 1 < argc) runs = (size_t)std::stoul(argv[++i]);
+        else if (a == "--micro_only") micro_only = true;
+        else if (a == "-h" || a == "--help") { usage(); return 0; }
+    }
+    if (scale < 1) scale = 1;
+    if (runs < 1) runs = 1;
+
+    Vector<Result> results;
+    micro(results, scale);
+    if (!micro_only) macro(results, bin_dir, corpus, queries, runs);
+    print_json(results);
+    return 0;
+}
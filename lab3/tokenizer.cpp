@@ -5,45 +5,12 @@
 #include <chrono>
 #include <filesystem>
 #include "../mystl/vector.hpp"
+#include "../mystl/mmap_file.hpp"
+#include "../libir/tokenize.hpp"
 
 namespace fs = std::filesystem;
 using mystl::Vector;
 
-static inline char tolower_ascii(char c) {
-    if (c >= 'A' && c <= 'Z') return (char)(c - 'A' + 'a');
-    return c;
-}
-
-static bool is_word_char(char c) {
-    return std::isalnum((unsigned char)c) != 0;
-}
-
-static void tokenize_line(const std::string& line, Vector<std::string>& out_tokens) {
-    std::string cur;
-    cur.reserve(32);
-
-    auto flush = [&]() {
-        if (cur.size() >= 2) out_tokens.push_back(cur);
-        cur.clear();
-    };
-
-    for (size_t i = 0; i < line.size(); ++i) {
-        char c = line[i];
-        char lc = tolower_ascii(c);
-
-        bool ok = is_word_char(lc);
-        bool hyphen = (lc == '-' && !cur.empty());
-        bool apost = (lc == '\'' && !cur.empty());
-
-        if (ok || hyphen || apost) {
-            cur.push_back(lc);
-        } else {
-            flush();
-        }
-    }
-    flush();
-}
-
 static void usage() {
     std::cout << "Usage: tokenizer --input_dir data_text\n";
 }
@@ -74,25 +41,16 @@ int main(int argc, char** argv) {
 
     auto t0 = std::chrono::high_resolution_clock::now();
 
-    Vector<std::string> toks;
-    toks.reserve(4096);
-
     for (size_t fi = 0; fi < files.size(); ++fi) {
-        std::ifstream in(files[fi], std::ios::binary);
-        if (!in) continue;
-
-        in.seekg(0, std::ios::end);
-        total_bytes += (uint64_t)in.tellg();
-        in.seekg(0, std::ios::beg);
-
-        std::string line;
-        while (std::getline(in, line)) {
-            toks.clear();
-            tokenize_line(line, toks);
-            for (size_t j = 0; j < toks.size(); ++j) {
-                total_tokens += 1;
-                total_token_chars += toks[j].size();
-            }
+        mystl::MappedFile mf;
+        if (!mf.open(files[fi].string())) continue;
+        total_bytes += (uint64_t)mf.size();
+
+        ir::TokenStream ts(mf.data(), mf.size());
+        std::string_view tok;
+        while (ts.next(tok)) {
+            total_tokens += 1;
+            total_token_chars += tok.size();
         }
     }
 
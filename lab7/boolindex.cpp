@@ -5,209 +5,1513 @@
 #include <filesystem>
 #include <chrono>
 #include <cstdint>
+#include <cstring>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "../mystl/vector.hpp"
 #include "../mystl/hashmap.hpp"
+#include "../mystl/mmap_file.hpp"
+#include "../mystl/intern_map.hpp"
+#include "../mystl/spsc_queue.hpp"
+#include "../libir/tokenize.hpp"
+#include "../libir/text.hpp"
+#include "../libir/codec.hpp"
+#include "../libir/index_format.hpp"
+#include "../libir/dict_fc.hpp"
+#include "../libir/stats.hpp"
 
 namespace fs = std::filesystem;
 using mystl::Vector;
+using namespace ir;
 
+static Stat S_WALK("walk_seconds", STAT_NANOS, "Listing the input directories.");
+static Stat S_REORDER("reorder_seconds", STAT_NANOS, "DocID reassignment (--reorder).");
+static Stat S_READ("read_seconds", STAT_NANOS, "Opening and mapping documents (with --stats, also faulting their pages in).");
+static Stat S_TOKENIZE("tokenize_seconds", STAT_NANOS, "Tokenizing documents (only measured with --stats).");
+static Stat S_STEM("stem_seconds", STAT_NANOS, "Stemming tokens (only measured with --stats).");
+static Stat S_INSERT("insert_seconds", STAT_NANOS, "Hash map lookups and posting appends (only measured with --stats).");
+static Stat S_SPILL("spill_seconds", STAT_NANOS, "Writing --mem_mb segments, sorting excluded.");
+static Stat S_MERGE("merge_seconds", STAT_NANOS, "Merging per-thread dictionaries or spilled segments, writing excluded.");
+static Stat S_SORT("sort_seconds", STAT_NANOS, "Sorting the dictionary.");
+static Stat S_WRITE("write_seconds", STAT_NANOS, "Encoding and writing the index files.");
+static Stat S_BUILD("build_seconds", STAT_NANOS, "Whole index builds, wall time.");
+static Stat S_DOCS("docs", STAT_COUNT, "Documents indexed.");
+static Stat S_BYTES_READ("bytes_read", STAT_COUNT, "Bytes of document text read.");
+static Stat S_TOKENS("tokens", STAT_COUNT, "Tokens indexed after stemming.");
+static Stat S_NEW_TERMS("term_inserts", STAT_COUNT, "First sightings of a term in a per-thread dictionary.");
+static Stat S_REHASH("rehashes", STAT_COUNT, "Dictionary hash table growths.");
+static Stat S_SEGMENTS("segments", STAT_COUNT, "Segments spilled under --mem_mb.");
+static Stat S_TERMS("terms", STAT_COUNT, "Terms written.");
+static Stat S_POSTINGS("postings", STAT_COUNT, "Postings written.");
+static Stat S_POSTINGS_BYTES("postings_bytes", STAT_COUNT, "Bytes written to postings.bin.");
+static Stat S_WAIT_READ("pipeline_read_waits", STAT_COUNT, "Times the --pipeline tokenizer found no file read yet.");
+static Stat S_WAIT_TOKENIZE("pipeline_tokenize_waits", STAT_COUNT, "Times the --pipeline inverter found no batch ready.");
+static Stat S_WAIT_FULL("pipeline_full_waits", STAT_COUNT, "Times a --pipeline stage found its output queue full.");
+
+// Set by --stats: documents are then tokenized, stemmed and inserted in three
+// timed passes instead of one interleaved loop.
+static bool g_phase_timers = false;
+
+// Stemmer of the index being built: --stemmer, or the existing index's on --append.
+static ir::StemMode g_stem = ir::STEM_LIGHT;
+
+// pos is the pos.bin stream of the list (empty unless indexing positions);
+// last_pos is the position most recently appended to it.
 struct PostingList {
     Vector<uint32_t> docs;
+    Vector<uint8_t> tf;
+    Vector<uint8_t> pos;
+    uint32_t last_pos = 0;
 };
 
-static inline char tolower_ascii(char c) {
-    if (c >= 'A' && c <= 'Z') return (char)(c - 'A' + 'a');
-    return c;
+typedef mystl::InternMap<PostingList> InvMap;
+
+// Terms are ordered by an 8-byte big-endian prefix first, so most comparisons
+// never touch the string pool; only equal prefixes fall back to the full key.
+struct TermKey {
+    uint64_t prefix;
+    uint32_t bucket;
+};
+
+static uint64_t key_prefix(std::string_view s) {
+    uint64_t p = 0;
+    for (size_t i = 0; i < 8; ++i) p = (p << 8) | (i < s.size() ? (unsigned char)s[i] : 0u);
+    return p;
+}
+
+static bool term_less(const TermKey& a, const TermKey& b, const InvMap& inv) {
+    if (a.prefix != b.prefix) return a.prefix < b.prefix;
+    return inv.key(inv.buckets()[a.bucket]) < inv.key(inv.buckets()[b.bucket]);
+}
+
+static void insertion_sort(TermKey* a, size_t n, const InvMap& inv) {
+    for (size_t i = 1; i < n; ++i) {
+        TermKey x = a[i];
+        size_t j = i;
+        while (j > 0 && term_less(x, a[j - 1], inv)) { a[j] = a[j - 1]; --j; }
+        a[j] = x;
+    }
 }
 
-static bool is_word_char(char c) {
-    return std::isalnum((unsigned char)c) != 0;
+static void sift_down(TermKey* a, size_t i, size_t n, const InvMap& inv) {
+    for (;;) {
+        size_t l = 2 * i + 1, r = l + 1, m = i;
+        if (l < n && term_less(a[m], a[l], inv)) m = l;
+        if (r < n && term_less(a[m], a[r], inv)) m = r;
+        if (m == i) return;
+        TermKey t = a[i]; a[i] = a[m]; a[m] = t;
+        i = m;
+    }
 }
 
-static void tokenize_line(const std::string& line, Vector<std::string>& out_tokens) {
-    std::string cur;
-    cur.reserve(32);
+static void heap_sort(TermKey* a, size_t n, const InvMap& inv) {
+    for (size_t i = n / 2; i-- > 0;) sift_down(a, i, n, inv);
+    for (size_t k = n; k-- > 1;) {
+        TermKey t = a[0]; a[0] = a[k]; a[k] = t;
+        sift_down(a, 0, k, inv);
+    }
+}
+
+// Sorts one top-byte bucket: LSD radix over prefix bytes 1..7, then runs of
+// equal prefixes by full key.
+static void sort_bucket(TermKey* a, TermKey* tmp, size_t n, const InvMap& inv) {
+    if (n < 32) { insertion_sort(a, n, inv); return; }
+    size_t cnt[256];
+    for (int shift = 0; shift < 56; shift += 8) {
+        for (size_t c = 0; c < 256; ++c) cnt[c] = 0;
+        for (size_t i = 0; i < n; ++i) ++cnt[(a[i].prefix >> shift) & 0xFF];
+        if (cnt[a[0].prefix >> shift & 0xFF] == n) continue;
+        size_t sum = 0;
+        for (size_t c = 0; c < 256; ++c) { size_t t = cnt[c]; cnt[c] = sum; sum += t; }
+        for (size_t i = 0; i < n; ++i) tmp[cnt[(a[i].prefix >> shift) & 0xFF]++] = a[i];
+        for (size_t i = 0; i < n; ++i) a[i] = tmp[i];
+    }
+    for (size_t i = 0; i < n;) {
+        size_t j = i + 1;
+        while (j < n && a[j].prefix == a[i].prefix) ++j;
+        if (j - i > 16) heap_sort(a + i, j - i, inv);
+        else if (j - i > 1) insertion_sort(a + i, j - i, inv);
+        i = j;
+    }
+}
 
-    auto flush = [&]() {
-        if (cur.size() >= 2) out_tokens.push_back(cur);
-        cur.clear();
+static Vector<size_t> sorted_terms(const InvMap& inv, int threads = 1) {
+    ScopedTimer timer(S_SORT);
+    Vector<TermKey> keys, tmp;
+    keys.reserve(inv.size());
+    for (size_t i = 0; i < inv.bucket_count(); ++i) {
+        if (inv.used(i)) keys.push_back({key_prefix(inv.key(inv.buckets()[i])), (uint32_t)i});
+    }
+    size_t n = keys.size();
+    tmp.resize(n);
+
+    size_t start[257];
+    for (size_t c = 0; c <= 256; ++c) start[c] = 0;
+    for (size_t i = 0; i < n; ++i) ++start[(keys[i].prefix >> 56) + 1];
+    for (size_t c = 0; c < 256; ++c) start[c + 1] += start[c];
+    size_t pos[256];
+    for (size_t c = 0; c < 256; ++c) pos[c] = start[c];
+    for (size_t i = 0; i < n; ++i) tmp[pos[keys[i].prefix >> 56]++] = keys[i];
+
+    std::atomic<size_t> next_bucket(0);
+    auto work = [&]() {
+        for (size_t c; (c = next_bucket++) < 256;) {
+            size_t len = start[c + 1] - start[c];
+            if (len) sort_bucket(tmp.data() + start[c], keys.data() + start[c], len, inv);
+        }
     };
+    if (threads > 1 && n > 65536) {
+        Vector<std::thread> workers;
+        for (int w = 0; w < threads; ++w) workers.emplace_back(work);
+        for (size_t w = 0; w < workers.size(); ++w) workers[w].join();
+    } else {
+        work();
+    }
+
+    Vector<size_t> idx;
+    idx.resize(n);
+    for (size_t i = 0; i < n; ++i) idx[i] = tmp[i].bucket;
+    return idx;
+}
+
+static void write_u32(std::ofstream& out, uint32_t v) { out.write((const char*)&v, sizeof(v)); }
+
+static size_t put_varint(Vector<uint8_t>& out, uint32_t v) {
+    size_t n = 1;
+    for (; v >= 0x80; v >>= 7, ++n) out.push_back((uint8_t)(v | 0x80));
+    out.push_back((uint8_t)v);
+    return n;
+}
+
+static bool read_u32(std::ifstream& in, uint32_t& v) {
+    in.read((char*)&v, sizeof(v));
+    return (bool)in;
+}
+
+struct Inverter {
+    InvMap inv;
+    size_t bytes = 0;
+    size_t budget = 0;
+    bool positions = false;
+    fs::path seg_dir;
+    std::string seg_prefix;
+    Vector<fs::path> segments;
+    size_t new_terms = 0;
+    size_t rehashes = 0;
+
+    // `at` is the token's position within document di.
+    void add(std::string_view term, uint32_t di, uint32_t at) {
+        PostingList* pl = inv.find(term);
+        if (!pl) {
+            PostingList empty;
+            size_t cap = inv.bucket_count();
+            pl = &inv.get_or_insert(term, empty);
+            bytes += term.size();
+            ++new_terms;
+            if (inv.bucket_count() != cap) ++rehashes;
+        }
+        if (pl->docs.empty() || pl->docs[pl->docs.size() - 1] != di) {
+            pl->docs.push_back(di);
+            pl->tf.push_back(1);
+            bytes += sizeof(uint32_t) + 1;
+            if (positions) {
+                bytes += put_varint(pl->pos, at + 1) + 1;
+                pl->pos.push_back(0);
+            }
+        } else {
+            uint8_t& tf = pl->tf[pl->tf.size() - 1];
+            if (tf < 255) ++tf;
+            if (positions) {
+                pl->pos.pop_back();
+                bytes += put_varint(pl->pos, at - pl->last_pos);
+                pl->pos.push_back(0);
+            }
+        }
+        pl->last_pos = at;
+    }
 
-    for (size_t i = 0; i < line.size(); ++i) {
-        char c = line[i];
-        char lc = tolower_ascii(c);
+    void trim() {
+        for (size_t i = 0; i < inv.bucket_count(); ++i) {
+            if (!inv.used(i)) continue;
+            inv.buckets()[i].value.docs.shrink_to_fit();
+            inv.buckets()[i].value.tf.shrink_to_fit();
+            inv.buckets()[i].value.pos.shrink_to_fit();
+        }
+    }
+
+    size_t estimate() const { return bytes + inv.bucket_count() * (sizeof(InvMap::Bucket) + 1); }
 
-        bool ok = is_word_char(lc);
-        bool hyphen = (lc == '-' && !cur.empty());
-        bool apost = (lc == '\'' && !cur.empty());
+    void maybe_flush() {
+        if (budget && estimate() > budget) flush();
+    }
 
-        if (ok || hyphen || apost) cur.push_back(lc);
-        else flush();
+    void flush() {
+        if (inv.size() == 0) return;
+        fs::path path = seg_dir / (seg_prefix + std::to_string(segments.size()) + ".seg");
+        std::ofstream out(path, std::ios::binary);
+        Vector<size_t> idx = sorted_terms(inv);
+        ScopedTimer timer(S_SPILL);
+        for (size_t k = 0; k < idx.size(); ++k) {
+            const auto& b = inv.buckets()[ idx[k] ];
+            write_u32(out, b.len);
+            out.write(inv.key(b).data(), (std::streamsize)b.len);
+            write_u32(out, (uint32_t)b.value.docs.size());
+            out.write((const char*)b.value.docs.data(), (std::streamsize)(sizeof(uint32_t) * b.value.docs.size()));
+            out.write((const char*)b.value.tf.data(), (std::streamsize)b.value.tf.size());
+            write_u32(out, (uint32_t)b.value.pos.size());
+            out.write((const char*)b.value.pos.data(), (std::streamsize)b.value.pos.size());
+        }
+        segments.push_back(path);
+        S_SEGMENTS.add(1);
+        inv = InvMap();
+        bytes = 0;
     }
-    flush();
+};
+
+// lens[di] receives the number of indexed tokens of document di.
+static void index_range(const Vector<fs::path>& doc_paths, size_t begin, size_t end, Inverter& inv, uint32_t* lens) {
+    std::string w;
+    w.reserve(64);
+    Vector<std::string> words;
+    size_t docs = 0, bytes = 0, tokens = 0;
+
+    for (size_t di = begin; di < end; ++di) {
+        mystl::MappedFile mf;
+        {
+            ScopedTimer timer(S_READ);
+            if (!mf.open(doc_paths[di].string())) continue;
+            if (g_phase_timers) {
+                uint8_t sum = 0;
+                for (size_t i = 0; i < mf.size(); i += 4096) sum += (uint8_t)mf.data()[i];
+                volatile uint8_t sink = sum;
+                (void)sink;
+            }
+        }
+        ++docs;
+        bytes += mf.size();
+
+        ir::TokenStream ts(mf.data(), mf.size());
+        std::string_view tok;
+        uint32_t n_tok = 0;
+        if (!g_phase_timers) {
+            while (ts.next(tok)) {
+                w.assign(tok.data(), tok.size());
+                stem_inplace(w, g_stem);
+                if (w.size() < 2) continue;
+                inv.add(w, (uint32_t)di, n_tok++);
+            }
+        } else {
+            size_t n = 0;
+            {
+                ScopedTimer timer(S_TOKENIZE);
+                while (ts.next(tok)) {
+                    if (n == words.size()) words.emplace_back();
+                    words[n++].assign(tok.data(), tok.size());
+                }
+            }
+            {
+                ScopedTimer timer(S_STEM);
+                for (size_t i = 0; i < n; ++i) stem_inplace(words[i], g_stem);
+            }
+            ScopedTimer timer(S_INSERT);
+            for (size_t i = 0; i < n; ++i) {
+                if (words[i].size() < 2) continue;
+                inv.add(words[i], (uint32_t)di, n_tok++);
+            }
+        }
+        lens[di] = n_tok;
+        tokens += n_tok;
+        inv.maybe_flush();
+    }
+    if (!inv.budget) inv.trim();
+    S_DOCS.add(docs);
+    S_BYTES_READ.add(bytes);
+    S_TOKENS.add(tokens);
+    S_NEW_TERMS.add(inv.new_terms);
+    S_REHASH.add(inv.rehashes);
 }
 
-static bool ends_with(const std::string& s, const char* suf) {
-    size_t n = s.size();
-    size_t m = 0;
-    while (suf[m]) ++m;
-    if (m > n) return false;
-    for (size_t i = 0; i < m; ++i) if (s[n - m + i] != suf[i]) return false;
-    return true;
+// --pipeline: the range is read, tokenized and inverted by three threads joined
+// by bounded SPSC queues. The reader hints the kernel PIPE_READAHEAD files ahead
+// (posix_fadvise) and read()s each file into one of PIPE_DEPTH pooled buffers;
+// the tokenizer turns a buffer into a batch of stemmed terms; the calling thread
+// appends the batch to `inv`. Buffers and batches go back to their producer over
+// a second queue, so nothing is allocated per document once the pools are warm.
+// A nullptr marks the end of the stream.
+static const size_t PIPE_DEPTH = 16;
+static const size_t PIPE_READAHEAD = 8;
+
+struct FileBuf {
+    uint32_t di = 0;
+    std::string data;
+};
+
+// Stemmed terms of one document, packed end to end; ends[i] closes term i.
+struct TermBatch {
+    uint32_t di = 0;
+    std::string bytes;
+    Vector<uint32_t> ends;
+};
+
+// Spins briefly, then sleeps, so a stage waiting on disk leaves the CPU to the others.
+static void pipe_wait(unsigned& spins) {
+    if (++spins < 64) std::this_thread::yield();
+    else std::this_thread::sleep_for(std::chrono::microseconds(50));
 }
 
-static void stem_inplace(std::string& w) {
-    if (w.size() < 4) return;
-    if (ends_with(w, "'s") && w.size() > 3) w.resize(w.size() - 2);
+template <class T>
+static void pipe_push(mystl::SpscQueue<T*>& q, T* v) {
+    unsigned spins = 0;
+    if (q.try_push(v)) return;
+    S_WAIT_FULL.add(1);
+    while (!q.try_push(v)) pipe_wait(spins);
+}
+
+template <class T>
+static T* pipe_pop(mystl::SpscQueue<T*>& q, Stat& waits) {
+    T* v = nullptr;
+    unsigned spins = 0;
+    if (q.try_pop(v)) return v;
+    waits.add(1);
+    while (!q.try_pop(v)) pipe_wait(spins);
+    return v;
+}
+
+static int open_hinted(const fs::path& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd >= 0) ::posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    return fd;
+}
 
-    if (ends_with(w, "sses") && w.size() > 6) { w.resize(w.size() - 2); return; }
-    if (ends_with(w, "ies")  && w.size() > 5) { w.resize(w.size() - 3); w.push_back('y'); return; }
-    if (ends_with(w, "s")    && w.size() > 4 && !ends_with(w, "ss")) { w.resize(w.size() - 1); }
+// Reads the whole file; false for an unreadable or empty one (skipped, as mmap does).
+static bool read_fd(int fd, std::string& out) {
+    struct stat st;
+    if (fd < 0 || ::fstat(fd, &st) != 0 || st.st_size <= 0) return false;
+    out.resize((size_t)st.st_size);
+    size_t done = 0;
+    while (done < out.size()) {
+        ssize_t r = ::read(fd, &out[done], out.size() - done);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        done += (size_t)r;
+    }
+    out.resize(done);
+    return done > 0;
+}
 
-    if (ends_with(w, "ing") && w.size() > 6) { w.resize(w.size() - 3); return; }
-    if (ends_with(w, "ed")  && w.size() > 5) { w.resize(w.size() - 2); return; }
-    if (ends_with(w, "ly")  && w.size() > 6) { w.resize(w.size() - 2); return; }
-    if (ends_with(w, "ment") && w.size() > 8) { w.resize(w.size() - 4); return; }
+static void pipe_reader(const Vector<fs::path>& doc_paths, size_t begin, size_t end,
+                        mystl::SpscQueue<FileBuf*>& free_bufs, mystl::SpscQueue<FileBuf*>& out) {
+    int fds[PIPE_READAHEAD];
+    size_t ahead = begin;
+    // The tokenizer is the only producer on free_bufs, so a buffer left unused
+    // by an empty or unreadable file stays here for the next one.
+    FileBuf* spare = nullptr;
+    for (size_t di = begin; di < end; ++di) {
+        for (; ahead < end && ahead < di + PIPE_READAHEAD; ++ahead) fds[ahead % PIPE_READAHEAD] = open_hinted(doc_paths[ahead]);
+        int fd = fds[di % PIPE_READAHEAD];
+        FileBuf* b = spare ? spare : pipe_pop(free_bufs, S_WAIT_FULL);
+        spare = nullptr;
+        bool ok;
+        {
+            ScopedTimer timer(S_READ);
+            ok = read_fd(fd, b->data);
+        }
+        if (fd >= 0) ::close(fd);
+        if (!ok) { spare = b; continue; }
+        S_BYTES_READ.add(b->data.size());
+        b->di = (uint32_t)di;
+        pipe_push(out, b);
+    }
+    pipe_push(out, (FileBuf*)nullptr);
 }
 
-static void write_varint(std::ofstream& out, uint32_t v) {
-    while (v >= 0x80) {
-        uint8_t b = (uint8_t)((v & 0x7F) | 0x80);
-        out.write((char*)&b, 1);
-        v >>= 7;
+static void pipe_tokenizer(mystl::SpscQueue<FileBuf*>& in, mystl::SpscQueue<FileBuf*>& free_bufs,
+                           mystl::SpscQueue<TermBatch*>& free_batches, mystl::SpscQueue<TermBatch*>& out) {
+    std::string w;
+    w.reserve(64);
+    Vector<std::string> words;
+    for (;;) {
+        FileBuf* b = pipe_pop(in, S_WAIT_READ);
+        if (!b) break;
+        TermBatch* t = pipe_pop(free_batches, S_WAIT_FULL);
+        t->di = b->di;
+        t->bytes.clear();
+        t->ends.clear();
+        ir::TokenStream ts(b->data.data(), b->data.size());
+        std::string_view tok;
+        if (!g_phase_timers) {
+            while (ts.next(tok)) {
+                w.assign(tok.data(), tok.size());
+                stem_inplace(w, g_stem);
+                if (w.size() < 2) continue;
+                t->bytes += w;
+                t->ends.push_back((uint32_t)t->bytes.size());
+            }
+        } else {
+            size_t n = 0;
+            {
+                ScopedTimer timer(S_TOKENIZE);
+                while (ts.next(tok)) {
+                    if (n == words.size()) words.emplace_back();
+                    words[n++].assign(tok.data(), tok.size());
+                }
+            }
+            ScopedTimer timer(S_STEM);
+            for (size_t i = 0; i < n; ++i) {
+                stem_inplace(words[i], g_stem);
+                if (words[i].size() < 2) continue;
+                t->bytes += words[i];
+                t->ends.push_back((uint32_t)t->bytes.size());
+            }
+        }
+        pipe_push(free_bufs, b);
+        pipe_push(out, t);
     }
-    uint8_t b = (uint8_t)(v & 0x7F);
-    out.write((char*)&b, 1);
+    pipe_push(out, (TermBatch*)nullptr);
 }
 
-static void quicksort_indices(Vector<size_t>& idx, size_t l, size_t r, const mystl::HashMap<PostingList>& map) {
-    if (l >= r) return;
-    size_t i = l, j = r;
-    const std::string& pivot = map.buckets()[ idx[(l + r) / 2] ].key;
+static void index_range_pipelined(const Vector<fs::path>& doc_paths, size_t begin, size_t end, Inverter& inv,
+                                  uint32_t* lens) {
+    Vector<FileBuf> bufs;
+    Vector<TermBatch> batches;
+    bufs.resize(PIPE_DEPTH);
+    batches.resize(PIPE_DEPTH);
+    mystl::SpscQueue<FileBuf*> free_bufs(PIPE_DEPTH), files(PIPE_DEPTH);
+    mystl::SpscQueue<TermBatch*> free_batches(PIPE_DEPTH), ready(PIPE_DEPTH);
+    for (size_t i = 0; i < PIPE_DEPTH; ++i) {
+        free_bufs.try_push(&bufs[i]);
+        free_batches.try_push(&batches[i]);
+    }
+
+    std::thread reader(pipe_reader, std::cref(doc_paths), begin, end, std::ref(free_bufs), std::ref(files));
+    std::thread tokenizer(pipe_tokenizer, std::ref(files), std::ref(free_bufs), std::ref(free_batches), std::ref(ready));
 
-    while (i <= j) {
-        while (map.buckets()[ idx[i] ].key < pivot) ++i;
-        while (map.buckets()[ idx[j] ].key > pivot) { if (j==0) break; --j; }
-        if (i <= j) {
-            size_t tmp = idx[i]; idx[i] = idx[j]; idx[j] = tmp;
-            ++i;
-            if (j==0) break;
-            --j;
+    size_t docs = 0, tokens = 0;
+    for (;;) {
+        TermBatch* t = pipe_pop(ready, S_WAIT_TOKENIZE);
+        if (!t) break;
+        {
+            ScopedTimer timer(S_INSERT);
+            uint32_t at = 0;
+            for (size_t i = 0; i < t->ends.size(); ++i) {
+                inv.add(std::string_view(t->bytes.data() + at, t->ends[i] - at), t->di, (uint32_t)i);
+                at = t->ends[i];
+            }
         }
+        lens[t->di] = (uint32_t)t->ends.size();
+        ++docs;
+        tokens += t->ends.size();
+        pipe_push(free_batches, t);
+        inv.maybe_flush();
     }
-    if (j > l) quicksort_indices(idx, l, j, map);
-    if (i < r) quicksort_indices(idx, i, r, map);
+    reader.join();
+    tokenizer.join();
+    if (!inv.budget) inv.trim();
+    S_DOCS.add(docs);
+    S_TOKENS.add(tokens);
+    S_NEW_TERMS.add(inv.new_terms);
+    S_REHASH.add(inv.rehashes);
 }
 
-static void usage() {
-    std::cout << "Usage: boolindex --input_dir data_text --out_dir out_bool\n";
+// Forward index for docID reordering: for each document, the sorted distinct
+// 64-bit hashes of its terms.
+static void forward_range(const Vector<fs::path>& doc_paths, size_t begin, size_t end, Vector< Vector<uint64_t> >& fwd) {
+    std::string w;
+    w.reserve(64);
+    for (size_t di = begin; di < end; ++di) {
+        mystl::MappedFile mf;
+        if (!mf.open(doc_paths[di].string())) continue;
+        Vector<uint64_t>& v = fwd[di];
+        ir::TokenStream ts(mf.data(), mf.size());
+        std::string_view tok;
+        while (ts.next(tok)) {
+            w.assign(tok.data(), tok.size());
+            stem_inplace(w, g_stem);
+            if (w.size() < 2) continue;
+            v.push_back(mystl::fnv1a_64(w.data(), w.size()));
+        }
+        std::sort(v.data(), v.data() + v.size());
+        v.resize((size_t)(std::unique(v.data(), v.data() + v.size()) - v.data()));
+    }
 }
 
-int main(int argc, char** argv) {
-    std::string input_dir = "data_text";
-    std::string out_dir = "out_bool";
+static const size_t BP_LEAF = 16;
+static const int BP_ITERS = 20;
 
-    for (int i = 1; i < argc; ++i) {
-        std::string a = argv[i];
-        if (a == "--input_dir" && i + 1 < argc) input_dir = argv[++i];
-        else if (a == "--out_dir" && i + 1 < argc) out_dir = argv[++i];
-        else if (a == "-h" || a == "--help") { usage(); return 0; }
+// Recursive graph bisection (Dhulipala et al., KDD 2016): split the documents
+// in half and swap the pairs whose move most lowers the estimated log-gap cost
+// of the terms' postings, then recurse into each half. Degree arrays are shared
+// across calls and only the entries the current documents touch are reset.
+struct Bisector {
+    const Vector< Vector<uint32_t> >& terms;
+    Vector<int32_t> deg1, deg2;
+    Vector<double> lg;
+    Vector<std::pair<double, uint32_t> > g1, g2;
+
+    Bisector(const Vector< Vector<uint32_t> >& t, size_t n_terms, size_t n_docs) : terms(t) {
+        deg1.resize(n_terms);
+        deg2.resize(n_terms);
+        lg.resize(n_docs + 2);
+        for (size_t i = 1; i < lg.size(); ++i) lg[i] = std::log2((double)i);
     }
 
-    fs::path out_index = fs::path(out_dir) / "index";
-    fs::create_directories(out_index);
+    double cost(int32_t d, size_t n) const { return d * (lg[n] - lg[(size_t)d + 1]); }
 
-    Vector<fs::path> doc_paths;
-    Vector<std::string> doc_sources;
+    // Gain of moving a document out of the side it is on (from = 1 or 2).
+    double gain(uint32_t doc, int from, size_t n1, size_t n2) const {
+        double g = 0;
+        const Vector<uint32_t>& ts = terms[doc];
+        for (size_t k = 0; k < ts.size(); ++k) {
+            int32_t a = deg1[ts[k]], b = deg2[ts[k]];
+            double before = cost(a, n1) + cost(b, n2);
+            g += (from == 1) ? before - cost(a - 1, n1) - cost(b + 1, n2)
+                             : before - cost(a + 1, n1) - cost(b - 1, n2);
+        }
+        return g;
+    }
+
+    void run(uint32_t* docs, size_t n) {
+        if (n <= BP_LEAF) return;
+        size_t n1 = n / 2, n2 = n - n1;
+        for (int it = 0; it < BP_ITERS; ++it) {
+            for (size_t i = 0; i < n; ++i) {
+                const Vector<uint32_t>& ts = terms[docs[i]];
+                for (size_t k = 0; k < ts.size(); ++k) deg1[ts[k]] = deg2[ts[k]] = 0;
+            }
+            for (size_t i = 0; i < n; ++i) {
+                const Vector<uint32_t>& ts = terms[docs[i]];
+                Vector<int32_t>& deg = (i < n1) ? deg1 : deg2;
+                for (size_t k = 0; k < ts.size(); ++k) ++deg[ts[k]];
+            }
+            g1.clear();
+            g2.clear();
+            for (size_t i = 0; i < n1; ++i) g1.push_back({-gain(docs[i], 1, n1, n2), docs[i]});
+            for (size_t i = n1; i < n; ++i) g2.push_back({-gain(docs[i], 2, n1, n2), docs[i]});
+            std::sort(g1.data(), g1.data() + g1.size());
+            std::sort(g2.data(), g2.data() + g2.size());
+            size_t swaps = 0;
+            for (; swaps < n1 && -(g1[swaps].first + g2[swaps].first) > 0; ++swaps) {}
+            if (!swaps) break;
+            for (size_t i = 0; i < n1; ++i) docs[i] = (i < swaps) ? g2[i].second : g1[i].second;
+            for (size_t i = 0; i < n2; ++i) docs[n1 + i] = (i < swaps) ? g1[i].second : g2[i].second;
+        }
+        run(docs, n1);
+        run(docs + n1, n2);
+    }
+};
+
+// New document order for --reorder: by path, or by graph bisection over term sets.
+static Vector<uint32_t> reorder_docs(const Vector<fs::path>& doc_paths, const std::string& mode, int threads) {
+    size_t n = doc_paths.size();
+    Vector<uint32_t> order;
+    order.resize(n);
+    for (size_t i = 0; i < n; ++i) order[i] = (uint32_t)i;
+    if (mode == "path") {
+        std::sort(order.data(), order.data() + n, [&](uint32_t a, uint32_t b) { return doc_paths[a] < doc_paths[b]; });
+        return order;
+    }
+
+    Vector< Vector<uint64_t> > fwd;
+    fwd.resize(n);
+    if (threads > 1) {
+        Vector<std::thread> workers;
+        size_t per = (n + threads - 1) / threads;
+        for (int w = 0; w < threads; ++w) {
+            size_t begin = (size_t)w * per;
+            size_t end = (begin + per < n) ? begin + per : n;
+            if (begin < end) workers.emplace_back(forward_range, std::cref(doc_paths), begin, end, std::ref(fwd));
+        }
+        for (size_t w = 0; w < workers.size(); ++w) workers[w].join();
+    } else {
+        forward_range(doc_paths, 0, n, fwd);
+    }
+
+    // Dense term ids; terms found in a single document cannot change any gap.
+    Vector<uint64_t> all;
+    for (size_t i = 0; i < n; ++i) {
+        size_t at = all.size();
+        all.resize(at + fwd[i].size());
+        if (fwd[i].size()) std::memcpy(all.data() + at, fwd[i].data(), sizeof(uint64_t) * fwd[i].size());
+    }
+    std::sort(all.data(), all.data() + all.size());
+    Vector<uint64_t> shared;
+    for (size_t i = 0; i < all.size();) {
+        size_t j = i + 1;
+        while (j < all.size() && all[j] == all[i]) ++j;
+        if (j - i > 1) shared.push_back(all[i]);
+        i = j;
+    }
+    all = Vector<uint64_t>();
+
+    Vector< Vector<uint32_t> > terms;
+    terms.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t k = 0; k < fwd[i].size(); ++k) {
+            const uint64_t* p = std::lower_bound(shared.data(), shared.data() + shared.size(), fwd[i][k]);
+            if (p != shared.data() + shared.size() && *p == fwd[i][k]) terms[i].push_back((uint32_t)(p - shared.data()));
+        }
+        fwd[i] = Vector<uint64_t>();
+    }
+
+    Bisector bp(terms, shared.size(), n);
+    bp.run(order.data(), n);
+    return order;
+}
+
+struct SegmentReader {
+    std::ifstream in;
+    std::string term;
+    Vector<uint32_t> docs;
+    Vector<uint8_t> tf;
+    Vector<uint8_t> pos;
 
-    for (auto src : {"wikipedia_en", "marinelink"}) {
-        fs::path p = fs::path(input_dir) / src;
-        if (!fs::exists(p)) continue;
-        for (auto& e : fs::directory_iterator(p)) {
-            if (e.is_regular_file() && e.path().extension() == ".txt") {
-                doc_paths.push_back(e.path());
-                doc_sources.push_back(std::string(src));
+    explicit SegmentReader(const fs::path& path) : in(path, std::ios::binary) {}
+
+    bool next() {
+        uint32_t len = 0, n = 0;
+        if (!read_u32(in, len)) return false;
+        term.resize(len);
+        in.read(&term[0], len);
+        if (!read_u32(in, n)) return false;
+        docs.resize(n);
+        in.read((char*)docs.data(), (std::streamsize)(sizeof(uint32_t) * n));
+        tf.resize(n);
+        in.read((char*)tf.data(), (std::streamsize)n);
+        if (!read_u32(in, n)) return false;
+        pos.resize(n);
+        in.read((char*)pos.data(), (std::streamsize)n);
+        return (bool)in;
+    }
+};
+
+// Writes postings.bin, dict.tsv, dict.fc, tf.bin, doclen.bin and, with
+// `positions`, pos.bin; `lens` holds the token count of every document the
+// postings refer to.
+struct IndexWriter {
+    fs::path dir;
+    uint32_t n_docs;
+    uint8_t codec;
+    const Vector<uint32_t>& lens;
+    bool positions;
+    std::ofstream postings;
+    std::ofstream dict;
+    std::ofstream tf_out;
+    std::ofstream pos_out;
+    FrontCodedWriter fc;
+    std::string enc;
+    uint64_t offset = sizeof(PostingsHeader);
+    Vector<uint64_t> tf_offs;
+    uint64_t tf_pos = sizeof(TfHeader);
+    Vector<uint64_t> pos_offs;
+    uint64_t pos_pos = sizeof(PosHeader);
+
+    IndexWriter(const fs::path& out_index, uint32_t n_docs_, uint8_t codec_, const Vector<uint32_t>& lens_,
+                bool positions_)
+        : dir(out_index), n_docs(n_docs_), codec(codec_), lens(lens_), positions(positions_),
+          postings(out_index / "postings.bin", std::ios::binary),
+          dict(out_index / "dict.tsv", std::ios::binary),
+          tf_out(out_index / "tf.bin", std::ios::binary) {
+        PostingsHeader ph;
+        std::memcpy(ph.magic, POSTINGS_MAGIC, 6);
+        ph.version = POSTINGS_VERSION;
+        ph.codec = codec;
+        postings.write((const char*)&ph, sizeof(ph));
+        TfHeader th;
+        std::memset(&th, 0, sizeof(th));
+        tf_out.write((const char*)&th, sizeof(th));
+        if (positions) {
+            pos_out.open(out_index / "pos.bin", std::ios::binary);
+            PosHeader sh;
+            std::memset(&sh, 0, sizeof(sh));
+            pos_out.write((const char*)&sh, sizeof(sh));
+        }
+    }
+
+    void add(std::string_view term, const Vector<uint32_t>& docs, const Vector<uint8_t>& tf,
+             const Vector<uint8_t>& pos) {
+        ScopedTimer timer(S_WRITE);
+        S_TERMS.add(1);
+        S_POSTINGS.add(docs.size());
+        dict << term << "\t" << offset << "\t" << docs.size() << "\n";
+
+        fc.add(term, offset, (uint32_t)docs.size());
+
+        encode_postings(docs, n_docs, codec, enc);
+        postings.write(enc.data(), (std::streamsize)enc.size());
+        offset += enc.size();
+        S_POSTINGS_BYTES.add(enc.size());
+
+        enc.clear();
+        for (size_t b = 0; b < docs.size(); b += SKIP_BLOCK) {
+            size_t e = (b + SKIP_BLOCK < docs.size()) ? b + SKIP_BLOCK : docs.size();
+            TfBlockMax m{0, UINT32_MAX};
+            for (size_t i = b; i < e; ++i) {
+                uint32_t len = (docs[i] < lens.size()) ? lens[docs[i]] : 0;
+                if (tf[i] > m.max_tf) m.max_tf = tf[i];
+                if (len < m.min_len) m.min_len = len;
             }
+            enc.append((const char*)&m, sizeof(m));
         }
+        enc.append((const char*)tf.data(), tf.size());
+        tf_out.write(enc.data(), (std::streamsize)enc.size());
+        tf_offs.push_back(tf_pos);
+        tf_pos += enc.size();
+
+        if (!positions) return;
+        enc.clear();
+        const uint8_t* p = pos.data();
+        const uint8_t* e = p + pos.size();
+        for (size_t i = 0; i < docs.size(); ++i) {
+            if (i % SKIP_BLOCK == 0) {
+                uint32_t off = (uint32_t)(p - pos.data());
+                enc.append((const char*)&off, sizeof(off));
+            }
+            const uint8_t* z = (const uint8_t*)std::memchr(p, 0, (size_t)(e - p));
+            p = z ? z + 1 : e;
+        }
+        enc.append((const char*)pos.data(), pos.size());
+        pos_out.write(enc.data(), (std::streamsize)enc.size());
+        pos_offs.push_back(pos_pos);
+        pos_pos += enc.size();
     }
 
+    size_t terms() const { return fc.size(); }
+
+    void finish() {
+        ScopedTimer timer(S_WRITE);
+        std::string img;
+        fc.finish(img);
+        std::ofstream out(dir / "dict.fc", std::ios::binary);
+        out.write(img.data(), (std::streamsize)img.size());
+        fs::remove(dir / "dict.bin");
+
+        TfHeader th;
+        std::memcpy(th.magic, TF_MAGIC, 8);
+        th.n_terms = (uint32_t)tf_offs.size();
+        th.reserved = 0;
+        th.table_off = tf_pos;
+        tf_out.write((const char*)tf_offs.data(), (std::streamsize)(sizeof(uint64_t) * tf_offs.size()));
+        tf_out.seekp(0);
+        tf_out.write((const char*)&th, sizeof(th));
+        tf_out.close();
+
+        if (positions) {
+            PosHeader sh;
+            std::memcpy(sh.magic, POS_MAGIC, 8);
+            sh.n_terms = (uint32_t)pos_offs.size();
+            sh.reserved = 0;
+            sh.table_off = pos_pos;
+            pos_out.write((const char*)pos_offs.data(), (std::streamsize)(sizeof(uint64_t) * pos_offs.size()));
+            pos_out.seekp(0);
+            pos_out.write((const char*)&sh, sizeof(sh));
+            pos_out.close();
+        } else {
+            fs::remove(dir / "pos.bin");
+        }
+
+        DocLenHeader lh;
+        std::memcpy(lh.magic, DOCLEN_MAGIC, 8);
+        lh.n_docs = (uint32_t)lens.size();
+        lh.reserved = 0;
+        lh.total_len = 0;
+        for (size_t i = 0; i < lens.size(); ++i) lh.total_len += lens[i];
+        std::ofstream dl(dir / "doclen.bin", std::ios::binary);
+        dl.write((const char*)&lh, sizeof(lh));
+        dl.write((const char*)lens.data(), (std::streamsize)(sizeof(uint32_t) * lens.size()));
+    }
+};
+
+template <class Reader>
+static bool seg_less(const Vector<Reader*>& rd, size_t a, size_t b) {
+    int c = rd[a]->term.compare(rd[b]->term);
+    return c < 0 || (c == 0 && a < b);
+}
+
+template <class Reader>
+static void heap_down(Vector<size_t>& heap, size_t i, const Vector<Reader*>& rd) {
+    for (;;) {
+        size_t l = 2 * i + 1, r = l + 1, m = i;
+        if (l < heap.size() && seg_less(rd, heap[l], heap[m])) m = l;
+        if (r < heap.size() && seg_less(rd, heap[r], heap[m])) m = r;
+        if (m == i) return;
+        size_t tmp = heap[i]; heap[i] = heap[m]; heap[m] = tmp;
+        i = m;
+    }
+}
+
+// Time spent in writer.add is left to write_seconds.
+template <class Reader>
+static void merge_segments(const Vector<Reader*>& rd, IndexWriter& writer) {
+    uint64_t t0 = now_ns(), w0 = S_WRITE.get();
+    Vector<size_t> heap;
+    for (size_t i = 0; i < rd.size(); ++i) {
+        if (rd[i]->next()) heap.push_back(i);
+    }
+    for (size_t i = heap.size(); i-- > 0;) heap_down(heap, i, rd);
+
+    std::string term;
+    Vector<uint32_t> merged;
+    Vector<uint8_t> merged_tf;
+    Vector<uint8_t> merged_pos;
+    while (!heap.empty()) {
+        term = rd[heap[0]]->term;
+        merged.clear();
+        merged_tf.clear();
+        merged_pos.clear();
+        while (!heap.empty() && rd[heap[0]]->term == term) {
+            Reader* r = rd[heap[0]];
+            size_t at = merged.size();
+            merged.resize(at + r->docs.size());
+            std::memcpy(merged.data() + at, r->docs.data(), sizeof(uint32_t) * r->docs.size());
+            merged_tf.resize(at + r->tf.size());
+            std::memcpy(merged_tf.data() + at, r->tf.data(), r->tf.size());
+            size_t pat = merged_pos.size();
+            merged_pos.resize(pat + r->pos.size());
+            if (r->pos.size()) std::memcpy(merged_pos.data() + pat, r->pos.data(), r->pos.size());
+            if (!r->next()) {
+                heap[0] = heap[heap.size() - 1];
+                heap.pop_back();
+            }
+            if (!heap.empty()) heap_down(heap, 0, rd);
+        }
+        writer.add(term, merged, merged_tf, merged_pos);
+    }
+    S_MERGE.add(now_ns() - t0 - (S_WRITE.get() - w0));
+}
+
+struct IndexSegmentReader {
+    std::ifstream dict;
+    mystl::MappedFile postings;
+    mystl::MappedFile tf_map;
+    mystl::MappedFile pos_map;
+    uint8_t version = 0;
+    uint8_t codec = CODEC_VARINT;
+    uint32_t doc_base;
+    uint32_t ord = 0;
+    std::string term;
+    Vector<uint32_t> docs;
+    Vector<uint8_t> tf;
+    Vector<uint8_t> pos;
+
+    IndexSegmentReader(const fs::path& dir, uint32_t doc_base_)
+        : dict(dir / "dict.tsv", std::ios::binary), doc_base(doc_base_) {
+        postings.open((dir / "postings.bin").string());
+        if (postings.size() >= sizeof(PostingsHeader) && std::memcmp(postings.data(), POSTINGS_MAGIC, 6) == 0) {
+            const PostingsHeader* h = (const PostingsHeader*)postings.data();
+            version = h->version;
+            codec = h->codec;
+        }
+        tf_map.open((dir / "tf.bin").string());
+        if (tf_map.size() < sizeof(TfHeader) || std::memcmp(tf_map.data(), TF_MAGIC, 8) != 0) tf_map.close();
+        pos_map.open((dir / "pos.bin").string());
+        if (pos_map.size() < sizeof(PosHeader) || std::memcmp(pos_map.data(), POS_MAGIC, 8) != 0) pos_map.close();
+    }
+
+    bool has_positions() const { return pos_map.is_open(); }
+
+    // dict.tsv lines follow dictionary order, so the line number is the tf.bin
+    // ordinal. Indexes built before tf.bin existed get tf = 1 everywhere.
+    void load_tf(uint32_t df) {
+        tf.resize(df);
+        const char* src = nullptr;
+        if (tf_map.is_open()) {
+            const TfHeader* h = (const TfHeader*)tf_map.data();
+            uint64_t slot = h->table_off + sizeof(uint64_t) * (uint64_t)ord;
+            if (ord < h->n_terms && slot + sizeof(uint64_t) <= tf_map.size()) {
+                uint64_t off;
+                std::memcpy(&off, tf_map.data() + slot, sizeof(off));
+                off += sizeof(TfBlockMax) * (uint64_t)((df + SKIP_BLOCK - 1) / SKIP_BLOCK);
+                if (off + df <= tf_map.size()) src = tf_map.data() + off;
+            }
+        }
+        if (src) std::memcpy(tf.data(), src, df);
+        else for (uint32_t i = 0; i < df; ++i) tf[i] = 1;
+    }
+
+    // Position stream of the current term (without its block offsets).
+    void load_pos(uint32_t df) {
+        pos.clear();
+        if (!pos_map.is_open()) return;
+        const PosHeader* h = (const PosHeader*)pos_map.data();
+        if (ord >= h->n_terms || h->table_off + sizeof(uint64_t) * (uint64_t)h->n_terms > pos_map.size()) return;
+        uint64_t begin, end = h->table_off;
+        std::memcpy(&begin, pos_map.data() + h->table_off + sizeof(uint64_t) * (uint64_t)ord, sizeof(begin));
+        if (ord + 1 < h->n_terms) std::memcpy(&end, pos_map.data() + h->table_off + sizeof(uint64_t) * (uint64_t)(ord + 1), sizeof(end));
+        begin += sizeof(uint32_t) * (uint64_t)((df + SKIP_BLOCK - 1) / SKIP_BLOCK);
+        if (begin > end || end > pos_map.size()) return;
+        pos.resize((size_t)(end - begin));
+        if (end > begin) std::memcpy(pos.data(), pos_map.data() + begin, (size_t)(end - begin));
+    }
+
+    bool next() {
+        std::string line;
+        while (std::getline(dict, line)) {
+            size_t p1 = line.find('\t');
+            size_t p2 = (p1==std::string::npos) ? std::string::npos : line.find('\t', p1+1);
+            if (p2 == std::string::npos) continue;
+            term = line.substr(0, p1);
+            uint64_t off = std::stoull(line.substr(p1 + 1, p2 - (p1 + 1)));
+            uint32_t df = (uint32_t)std::stoul(line.substr(p2 + 1));
+            const uint8_t* begin = (const uint8_t*)postings.data();
+            if (off > postings.size()) return false;
+            decode_postings(begin + off, begin + postings.size(), df, version, codec, doc_base, docs);
+            load_tf((uint32_t)docs.size());
+            load_pos((uint32_t)docs.size());
+            ++ord;
+            return true;
+        }
+        return false;
+    }
+};
+
+struct DeltaInfo {
+    std::string name;
+    uint32_t doc_base;
+    uint32_t n_docs;
+};
+
+static Vector<DeltaInfo> read_manifest(const fs::path& root) {
+    Vector<DeltaInfo> r;
+    std::ifstream in(root / "segments.tsv", std::ios::binary);
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t p1 = line.find('\t');
+        size_t p2 = (p1==std::string::npos) ? std::string::npos : line.find('\t', p1+1);
+        if (p2 == std::string::npos) continue;
+        DeltaInfo d;
+        d.name = line.substr(0, p1);
+        d.doc_base = (uint32_t)std::stoul(line.substr(p1 + 1, p2 - (p1 + 1)));
+        d.n_docs = (uint32_t)std::stoul(line.substr(p2 + 1));
+        r.push_back(d);
+    }
+    return r;
+}
+
+static void read_docs_tsv(const fs::path& dir, Vector<std::string>& paths, Vector<std::string>& sources) {
+    std::ifstream in(dir / "docs.tsv", std::ios::binary);
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t p1 = line.find('\t');
+        size_t p2 = (p1==std::string::npos) ? std::string::npos : line.find('\t', p1+1);
+        if (p2 == std::string::npos) continue;
+        sources.push_back(line.substr(p1 + 1, p2 - (p1 + 1)));
+        paths.push_back(line.substr(p2 + 1));
+    }
+}
+
+// Documents of an index and all its deltas, in docID order.
+static void read_index_docs(const fs::path& root, Vector<std::string>& paths, Vector<std::string>& sources) {
+    read_docs_tsv(root, paths, sources);
+    Vector<DeltaInfo> deltas = read_manifest(root);
+    for (size_t i = 0; i < deltas.size(); ++i) read_docs_tsv(root / deltas[i].name, paths, sources);
+}
+
+// shards.tsv of a sharded index: "<name>\t<range|hash>" per shard, in docID order.
+static Vector<std::string> read_shards(const fs::path& root, std::string& by) {
+    Vector<std::string> names;
+    std::ifstream in(root / "shards.tsv", std::ios::binary);
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t p1 = line.find('\t');
+        if (p1 == std::string::npos || p1 == 0) continue;
+        names.push_back(line.substr(0, p1));
+        by = line.substr(p1 + 1);
+    }
+    return names;
+}
+
+static void remove_shards(const fs::path& root) {
+    std::string by;
+    Vector<std::string> stale = read_shards(root, by);
+    for (size_t i = 0; i < stale.size(); ++i) fs::remove_all(root / stale[i]);
+    fs::remove(root / "shards.tsv");
+}
+
+// Appends the n document lengths of an index directory; zeros when doclen.bin is absent.
+static void read_doc_lens(const fs::path& dir, size_t n, Vector<uint32_t>& lens) {
+    size_t at = lens.size();
+    lens.resize(at + n);
+    mystl::MappedFile mf;
+    if (!mf.open((dir / "doclen.bin").string()) || mf.size() < sizeof(DocLenHeader)) return;
+    const DocLenHeader* h = (const DocLenHeader*)mf.data();
+    if (std::memcmp(h->magic, DOCLEN_MAGIC, 8) != 0) return;
+    size_t have = (mf.size() - sizeof(DocLenHeader)) / sizeof(uint32_t);
+    if (have > h->n_docs) have = h->n_docs;
+    if (have > n) have = n;
+    std::memcpy(lens.data() + at, mf.data() + sizeof(DocLenHeader), sizeof(uint32_t) * have);
+}
+
+static void write_docs(const fs::path& out_index, const Vector<std::string>& paths,
+                       const Vector<std::string>& sources, uint32_t doc_base) {
     {
-        std::ofstream docs(fs::path(out_index) / "docs.tsv", std::ios::binary);
-        for (size_t i = 0; i < doc_paths.size(); ++i) {
-            docs << i << "\t" << doc_sources[i] << "\t" << doc_paths[i].string() << "\n";
+        std::ofstream docs(out_index / "docs.tsv", std::ios::binary);
+        for (size_t i = 0; i < paths.size(); ++i) {
+            docs << (doc_base + i) << "\t" << sources[i] << "\t" << paths[i] << "\n";
         }
     }
 
-    mystl::HashMap<PostingList> inv;
+    Vector<DocsBinEntry> ents;
+    ents.reserve(paths.size());
+    std::string strs;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        DocsBinEntry e;
+        e.path_off = strs.size();
+        e.path_len = (uint32_t)paths[i].size();
+        e.source = (sources[i] == "wikipedia_en") ? 0u : 1u;
+        ents.push_back(e);
+        strs += paths[i];
+    }
+    DocsBinHeader h;
+    std::memcpy(h.magic, DOCS_BIN_MAGIC, 8);
+    h.n_docs = (uint32_t)ents.size();
+    h.reserved = 0;
+    h.strings_size = strs.size();
+
+    std::ofstream out(out_index / "docs.bin", std::ios::binary);
+    out.write((const char*)&h, sizeof(h));
+    out.write((const char*)ents.data(), (std::streamsize)(sizeof(DocsBinEntry) * ents.size()));
+    out.write(strs.data(), (std::streamsize)strs.size());
+}
+
+static int compact_index(const fs::path& root, uint8_t codec) {
+    Vector<DeltaInfo> deltas = read_manifest(root);
+    if (deltas.empty()) { std::cout << "nothing to compact\n"; return 0; }
+
+    fs::path tmp = root.string() + ".compact";
+    fs::path old = root.string() + ".old";
+    fs::remove_all(tmp);
+    fs::remove_all(old);
+    fs::create_directories(tmp);
 
     auto t0 = std::chrono::high_resolution_clock::now();
 
-    Vector<std::string> toks;
-    toks.reserve(4096);
+    Vector<std::string> paths, sources;
+    Vector<uint32_t> lens;
+    read_docs_tsv(root, paths, sources);
+    read_doc_lens(root, paths.size(), lens);
+    Vector<IndexSegmentReader*> rd;
+    rd.push_back(new IndexSegmentReader(root, 0));
+    for (size_t i = 0; i < deltas.size(); ++i) {
+        fs::path dir = root / deltas[i].name;
+        rd.push_back(new IndexSegmentReader(dir, deltas[i].doc_base));
+        read_docs_tsv(dir, paths, sources);
+        read_doc_lens(dir, paths.size() - lens.size(), lens);
+    }
+    write_docs(tmp, paths, sources, 0);
+    if (fs::exists(root / "stemmer.txt")) fs::copy_file(root / "stemmer.txt", tmp / "stemmer.txt");
 
-    for (size_t di = 0; di < doc_paths.size(); ++di) {
-        std::ifstream in(doc_paths[di], std::ios::binary);
-        if (!in) continue;
+    bool positions = true;
+    for (size_t i = 0; i < rd.size(); ++i) positions = positions && rd[i]->has_positions();
+    IndexWriter writer(tmp, (uint32_t)paths.size(), codec, lens, positions);
+    merge_segments(rd, writer);
+    writer.finish();
+    writer.postings.close();
+    writer.dict.close();
+    for (size_t i = 0; i < rd.size(); ++i) delete rd[i];
 
-        std::string line;
-        while (std::getline(in, line)) {
-            toks.clear();
-            tokenize_line(line, toks);
-            for (size_t j = 0; j < toks.size(); ++j) {
-                stem_inplace(toks[j]);
-                if (toks[j].size() < 2) continue;
-
-                PostingList* pl = inv.find(toks[j]);
-                if (!pl) {
-                    PostingList empty;
-                    PostingList& ref = inv.get_or_insert(toks[j], empty);
-                    ref.docs.push_back((uint32_t)di);
-                } else {
-                    if (pl->docs.empty() || pl->docs[pl->docs.size() - 1] != (uint32_t)di) {
-                        pl->docs.push_back((uint32_t)di);
-                    }
-                }
-            }
+    fs::rename(root, old);
+    fs::rename(tmp, root);
+    fs::remove_all(old);
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+    std::cout << "docs: " << paths.size() << "\n";
+    std::cout << "terms: " << writer.terms() << "\n";
+    std::cout << "merged_segments: " << rd.size() << "\n";
+    std::cout << "index_dir: " << root.string() << "\n";
+    std::cout << "time_s: " << std::chrono::duration<double>(t1 - t0).count() << "\n";
+    return 0;
+}
+
+static void merge_into(InvMap& inv, InvMap& part) {
+    for (size_t i = 0; i < part.bucket_count(); ++i) {
+        if (!part.used(i)) continue;
+        auto& b = part.buckets()[i];
+        std::string_view term = part.key(b);
+        PostingList* pl = inv.find(term);
+        if (!pl) {
+            PostingList empty;
+            pl = &inv.get_or_insert(term, empty);
         }
+        if (pl->docs.empty()) {
+            pl->docs = std::move(b.value.docs);
+            pl->tf = std::move(b.value.tf);
+            pl->pos = std::move(b.value.pos);
+            continue;
+        }
+        size_t at = pl->docs.size();
+        pl->docs.resize(at + b.value.docs.size());
+        std::memcpy(pl->docs.data() + at, b.value.docs.data(), sizeof(uint32_t) * b.value.docs.size());
+        pl->tf.resize(at + b.value.tf.size());
+        std::memcpy(pl->tf.data() + at, b.value.tf.data(), b.value.tf.size());
+        at = pl->pos.size();
+        pl->pos.resize(at + b.value.pos.size());
+        if (b.value.pos.size()) std::memcpy(pl->pos.data() + at, b.value.pos.data(), b.value.pos.size());
+        b.value.docs = Vector<uint32_t>();
+        b.value.tf = Vector<uint8_t>();
+        b.value.pos = Vector<uint8_t>();
     }
+}
 
-    Vector<size_t> idx;
-    idx.reserve(inv.bucket_count());
-    for (size_t i = 0; i < inv.bucket_count(); ++i) {
-        const auto& b = inv.buckets()[i];
-        if (b.used) idx.push_back(i);
+struct BuildOptions {
+    uint8_t codec = CODEC_VARINT;
+    int threads = 1;
+    size_t mem_mb = 0;
+    bool append = false;
+    bool positions = false;
+    bool pipeline = false;
+    ir::StemMode stem = ir::STEM_LIGHT;
+    std::string reorder;
+};
+
+// Builds (or with opt.append, extends by a delta) the single index at root_index.
+static int build_index(const fs::path& root_index, Vector<fs::path> doc_paths, Vector<std::string> doc_sources,
+                       const BuildOptions& opt) {
+    uint8_t codec = opt.codec;
+    int threads = opt.threads;
+    size_t mem_mb = opt.mem_mb;
+    bool append = opt.append;
+    bool positions = opt.positions;
+    const std::string& reorder = opt.reorder;
+
+    fs::path out_index = root_index;
+    uint32_t doc_base = 0;
+    Vector<DeltaInfo> deltas;
+    std::string delta_name;
+    g_stem = opt.stem;
+
+    if (append && fs::exists(root_index / "docs.tsv")) {
+        if (fs::exists(root_index / "pos.bin")) positions = true;
+        if (!ir::read_stem_mode(root_index.string(), g_stem)) {
+            std::cerr << "Unknown stemmer in " << (root_index / "stemmer.txt").string() << "\n";
+            return 2;
+        }
+        deltas = read_manifest(root_index);
+        Vector<std::string> known_paths, known_sources;
+        read_index_docs(root_index, known_paths, known_sources);
+
+        mystl::HashMap<int> known(known_paths.size());
+        for (size_t i = 0; i < known_paths.size(); ++i) known.get_or_insert(known_paths[i], 1);
+
+        Vector<fs::path> fresh_paths;
+        Vector<std::string> fresh_sources;
+        for (size_t i = 0; i < doc_paths.size(); ++i) {
+            if (known.find(doc_paths[i].string())) continue;
+            fresh_paths.push_back(doc_paths[i]);
+            fresh_sources.push_back(doc_sources[i]);
+        }
+        if (fresh_paths.empty()) { std::cout << "no new documents\n"; return 0; }
+        doc_paths = std::move(fresh_paths);
+        doc_sources = std::move(fresh_sources);
+
+        doc_base = (uint32_t)known_paths.size();
+        std::string num = std::to_string(deltas.size() + 1);
+        while (num.size() < 6) num = "0" + num;
+        delta_name = "delta_" + num;
+        out_index = root_index / delta_name;
+    } else if (fs::exists(root_index)) {
+        Vector<DeltaInfo> stale = read_manifest(root_index);
+        for (size_t i = 0; i < stale.size(); ++i) fs::remove_all(root_index / stale[i].name);
+        fs::remove(root_index / "segments.tsv");
+        remove_shards(root_index);
+    }
+    fs::create_directories(out_index);
+
+    // The new order is applied to the document list itself, so docs.tsv, the
+    // postings and every per-document file come out renumbered together.
+    if (!reorder.empty() && doc_paths.size() > 1) {
+        ScopedTimer timer(S_REORDER);
+        auto r0 = std::chrono::high_resolution_clock::now();
+        Vector<uint32_t> order = reorder_docs(doc_paths, reorder, threads < 1 ? 1 : threads);
+        Vector<fs::path> by_order;
+        Vector<std::string> by_order_src;
+        by_order.reserve(order.size());
+        by_order_src.reserve(order.size());
+        for (size_t i = 0; i < order.size(); ++i) {
+            by_order.push_back(doc_paths[order[i]]);
+            by_order_src.push_back(doc_sources[order[i]]);
+        }
+        doc_paths = std::move(by_order);
+        doc_sources = std::move(by_order_src);
+        auto r1 = std::chrono::high_resolution_clock::now();
+        std::cout << "reorder (" << reorder << "): "
+                  << std::chrono::duration<double>(r1 - r0).count() << " s\n";
+    }
+
+    {
+        Vector<std::string> paths;
+        paths.reserve(doc_paths.size());
+        for (size_t i = 0; i < doc_paths.size(); ++i) paths.push_back(doc_paths[i].string());
+        write_docs(out_index, paths, doc_sources, doc_base);
+        ir::write_stem_mode(out_index.string(), g_stem);
     }
-    if (!idx.empty()) quicksort_indices(idx, 0, idx.size() - 1, inv);
 
-    std::ofstream postings(fs::path(out_index) / "postings.bin", std::ios::binary);
-    std::ofstream dict(fs::path(out_index) / "dict.tsv", std::ios::binary);
+    auto t0 = std::chrono::high_resolution_clock::now();
+    ScopedTimer build_timer(S_BUILD);
 
-    uint64_t offset = 0;
-    for (size_t k = 0; k < idx.size(); ++k) {
-        const auto& b = inv.buckets()[ idx[k] ];
-        const std::string& term = b.key;
-        const PostingList& pl = b.value;
+    if (threads < 1) threads = 1;
+    if ((size_t)threads > doc_paths.size()) threads = doc_paths.size() ? (int)doc_paths.size() : 1;
+
+    fs::path seg_dir = out_index / "segments";
+    Vector<Inverter> parts;
+    for (int w = 0; w < threads; ++w) {
+        parts.emplace_back();
+        parts[w].budget = mem_mb * 1024 * 1024 / (size_t)threads;
+        parts[w].positions = positions;
+        parts[w].seg_dir = seg_dir;
+        parts[w].seg_prefix = "w" + std::to_string(w) + "_";
+    }
+    if (mem_mb) fs::create_directories(seg_dir);
 
-        dict << term << "\t" << offset << "\t" << pl.docs.size() << "\n";
+    Vector<uint32_t> lens;
+    lens.resize(doc_paths.size());
 
-        uint32_t prev = 0;
-        for (size_t j = 0; j < pl.docs.size(); ++j) {
-            uint32_t v = pl.docs[j];
-            uint32_t gap = (j == 0) ? v : (v - prev);
-            write_varint(postings, gap);
-            prev = v;
+    auto range_fn = opt.pipeline ? index_range_pipelined : index_range;
+    if (threads == 1) {
+        range_fn(doc_paths, 0, doc_paths.size(), parts[0], lens.data());
+    } else {
+        Vector<std::thread> workers;
+        size_t per = (doc_paths.size() + threads - 1) / threads;
+        for (int w = 0; w < threads; ++w) {
+            size_t begin = (size_t)w * per;
+            size_t end = (begin + per < doc_paths.size()) ? begin + per : doc_paths.size();
+            workers.emplace_back(range_fn, std::cref(doc_paths), begin, end, std::ref(parts[w]), lens.data());
         }
-        offset = (uint64_t)postings.tellp();
+        for (size_t w = 0; w < workers.size(); ++w) workers[w].join();
+    }
+
+    IndexWriter writer(out_index, (uint32_t)doc_paths.size(), codec, lens, positions);
+    size_t n_segments = 0;
+
+    if (mem_mb) {
+        Vector<fs::path> segments;
+        for (int w = 0; w < threads; ++w) {
+            parts[w].flush();
+            for (size_t k = 0; k < parts[w].segments.size(); ++k) segments.push_back(parts[w].segments[k]);
+        }
+        n_segments = segments.size();
+        Vector<SegmentReader*> rd;
+        for (size_t i = 0; i < segments.size(); ++i) rd.push_back(new SegmentReader(segments[i]));
+        merge_segments(rd, writer);
+        for (size_t i = 0; i < rd.size(); ++i) delete rd[i];
+        fs::remove_all(seg_dir);
+    } else {
+        InvMap inv = std::move(parts[0].inv);
+        {
+            ScopedTimer timer(S_MERGE);
+            size_t upper = inv.size();
+            for (int w = 1; w < threads; ++w) upper += parts[w].inv.size();
+            inv.reserve(upper);
+            for (int w = 1; w < threads; ++w) merge_into(inv, parts[w].inv);
+        }
+
+        Vector<size_t> idx = sorted_terms(inv, threads);
+        for (size_t k = 0; k < idx.size(); ++k) {
+            const auto& b = inv.buckets()[ idx[k] ];
+            writer.add(inv.key(b), b.value.docs, b.value.tf, b.value.pos);
+        }
+    }
+    writer.finish();
+
+    if (!delta_name.empty()) {
+        std::ofstream manifest(root_index / "segments.tsv", std::ios::binary | std::ios::app);
+        manifest << delta_name << "\t" << doc_base << "\t" << doc_paths.size() << "\n";
     }
 
     auto t1 = std::chrono::high_resolution_clock::now();
     double sec = std::chrono::duration<double>(t1 - t0).count();
 
     std::cout << "docs: " << doc_paths.size() << "\n";
-    std::cout << "terms: " << idx.size() << "\n";
+    std::cout << "terms: " << writer.terms() << "\n";
+    if (mem_mb) std::cout << "segments: " << n_segments << "\n";
     std::cout << "index_dir: " << out_index.string() << "\n";
     std::cout << "time_s: " << sec << "\n";
-    std::cout << "files: docs.tsv dict.tsv postings.bin\n";
+    std::cout << "files: docs.tsv dict.tsv postings.bin docs.bin dict.fc tf.bin doclen.bin"
+              << (positions ? " pos.bin" : "") << "\n";
+    return 0;
+}
+
+// Splits the collection into independent indexes index/shard_NNN listed in
+// shards.tsv: contiguous ranges of the document list, or a hash of the path.
+// With opt.append new documents are routed the same way (a range index sends
+// them all to its last shard) and become deltas of their shards.
+static int build_sharded(const fs::path& root_index, const Vector<fs::path>& doc_paths,
+                         const Vector<std::string>& doc_sources, size_t n_shards, std::string by, BuildOptions opt) {
+    std::string old_by;
+    Vector<std::string> names = read_shards(root_index, old_by);
+    if (opt.append && !names.empty()) {
+        by = old_by;
+    } else {
+        opt.append = false;
+        if (fs::exists(root_index)) {
+            Vector<DeltaInfo> stale = read_manifest(root_index);
+            for (size_t i = 0; i < stale.size(); ++i) fs::remove_all(root_index / stale[i].name);
+            fs::remove(root_index / "segments.tsv");
+            remove_shards(root_index);
+            for (auto f : {"docs.tsv", "docs.bin", "dict.tsv", "dict.fc", "dict.bin", "postings.bin", "tf.bin", "doclen.bin", "pos.bin", "stemmer.txt"})
+                fs::remove(root_index / f);
+        }
+        fs::create_directories(root_index);
+        names.clear();
+        std::ofstream manifest(root_index / "shards.tsv", std::ios::binary);
+        for (size_t s = 0; s < n_shards; ++s) {
+            std::string num = std::to_string(s);
+            while (num.size() < 3) num = "0" + num;
+            names.push_back("shard_" + num);
+            manifest << names[s] << "\t" << by << "\n";
+        }
+    }
+    n_shards = names.size();
+
+    mystl::HashMap<int> known(16);
+    if (opt.append) {
+        Vector<std::string> known_paths, known_sources;
+        for (size_t s = 0; s < n_shards; ++s) read_index_docs(root_index / names[s], known_paths, known_sources);
+        for (size_t i = 0; i < known_paths.size(); ++i) known.get_or_insert(known_paths[i], 1);
+    }
+
+    Vector< Vector<fs::path> > paths;
+    Vector< Vector<std::string> > sources;
+    paths.resize(n_shards);
+    sources.resize(n_shards);
+    size_t fresh = 0;
+    for (size_t i = 0; i < doc_paths.size(); ++i) {
+        std::string path = doc_paths[i].string();
+        if (opt.append && known.find(path)) continue;
+        size_t s;
+        if (by == "hash") s = (size_t)((mystl::fnv1a_64(path.data(), path.size()) >> 32) % n_shards);
+        else s = opt.append ? n_shards - 1 : i * n_shards / doc_paths.size();
+        paths[s].push_back(doc_paths[i]);
+        sources[s].push_back(doc_sources[i]);
+        ++fresh;
+    }
+    if (opt.append && !fresh) { std::cout << "no new documents\n"; return 0; }
+
+    for (size_t s = 0; s < n_shards; ++s) {
+        if (opt.append && paths[s].empty()) continue;
+        std::cout << "shard: " << names[s] << "\n";
+        int rc = build_index(root_index / names[s], std::move(paths[s]), std::move(sources[s]), opt);
+        if (rc != 0) return rc;
+    }
     return 0;
 }
+
+static void usage() {
+    std::cout << "Usage: boolindex --input_dir data_text --out_dir out_bool [--codec varint|bp128] [--threads N] [--mem_mb N] [--positions] [--reorder path|bp]\n"
+                 "                 [--shards N [--shard_by range|hash]] [--append] [--pipeline] [--stemmer light|porter]\n"
+                 "                 [--stats file|-]\n";
+    std::cout << "       boolindex --out_dir out_bool --compact [--codec varint|bp128] [--stats file|-]\n";
+}
+
+// --stats: the phase counters as JSON, to a file or ("-") to stderr.
+static int write_stats(const std::string& path, int rc) {
+    if (path.empty()) return rc;
+    std::string json = stats_json("boolindex");
+    if (path == "-") { std::cerr << json; return rc; }
+    std::ofstream out(path, std::ios::binary);
+    out << json;
+    if (!out) { std::cerr << "Cannot write " << path << "\n"; return rc ? rc : 2; }
+    return rc;
+}
+
+int main(int argc, char** argv) {
+    std::string input_dir = "data_text";
+    std::string out_dir = "out_bool";
+    uint8_t codec = CODEC_VARINT;
+    int threads = 1;
+    size_t mem_mb = 0;
+    bool append = false;
+    bool compact = false;
+    bool positions = false;
+    bool pipeline = false;
+    ir::StemMode stem = ir::STEM_LIGHT;
+    std::string reorder;
+    size_t shards = 0;
+    std::string shard_by = "range";
+    std::string stats_path;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--input_dir" && i + 1 < argc) input_dir = argv[++i];
+        else if (a == "--out_dir" && i + 1 < argc) out_dir = argv[++i];
+        else if (a == "--codec" && i + 1 < argc) {
+            std::string c = argv[++i];
+            if (c == "varint") codec = CODEC_VARINT;
+            else if (c == "bp128") codec = CODEC_BP128;
+            else { usage(); return 1; }
+        }
+        else if (a == "--threads" && i + 1 < argc) threads = std::stoi(argv[++i]);
+        else if (a == "--mem_mb" && i + 1 < argc) mem_mb = (size_t)std::stoull(argv[++i]);
+        else if (a == "--append") append = true;
+        else if (a == "--compact") compact = true;
+        else if (a == "--positions") positions = true;
+        else if (a == "--pipeline") pipeline = true;
+        else if (a == "--stemmer" && i + 1 < argc) {
+            if (!ir::parse_stem_mode(argv[++i], stem)) { usage(); return 1; }
+        }
+        else if (a == "--reorder" && i + 1 < argc) {
+            reorder = argv[++i];
+            if (reorder != "path" && reorder != "bp") { usage(); return 1; }
+        }
+        else if (a == "--shards" && i + 1 < argc) shards = (size_t)std::stoul(argv[++i]);
+        else if (a == "--shard_by" && i + 1 < argc) {
+            shard_by = argv[++i];
+            if (shard_by != "range" && shard_by != "hash") { usage(); return 1; }
+        }
+        else if (a == "--stats" && i + 1 < argc) stats_path = argv[++i];
+        else if (a == "-h" || a == "--help") { usage(); return 0; }
+    }
+    g_phase_timers = !stats_path.empty();
+
+    fs::path root_index = fs::path(out_dir) / "index";
+    if (compact) {
+        std::string by;
+        Vector<std::string> names = read_shards(root_index, by);
+        if (names.empty()) return write_stats(stats_path, compact_index(root_index, codec));
+        for (size_t s = 0; s < names.size(); ++s) {
+            int rc = compact_index(root_index / names[s], codec);
+            if (rc != 0) return write_stats(stats_path, rc);
+        }
+        return write_stats(stats_path, 0);
+    }
+
+    Vector<fs::path> doc_paths;
+    Vector<std::string> doc_sources;
+
+    {
+        ScopedTimer timer(S_WALK);
+        for (auto src : {"wikipedia_en", "marinelink"}) {
+            fs::path p = fs::path(input_dir) / src;
+            if (!fs::exists(p)) continue;
+            for (auto& e : fs::directory_iterator(p)) {
+                if (e.is_regular_file() && e.path().extension() == ".txt") {
+                    doc_paths.push_back(e.path());
+                    doc_sources.push_back(std::string(src));
+                }
+            }
+        }
+    }
+
+    BuildOptions opt;
+    opt.codec = codec;
+    opt.threads = threads;
+    opt.mem_mb = mem_mb;
+    opt.append = append;
+    opt.positions = positions;
+    opt.pipeline = pipeline;
+    opt.stem = stem;
+    opt.reorder = reorder;
+    int rc;
+    if (shards > 0 || (append && fs::exists(root_index / "shards.tsv")))
+        rc = build_sharded(root_index, doc_paths, doc_sources, shards, shard_by, opt);
+    else
+        rc = build_index(root_index, std::move(doc_paths), std::move(doc_sources), opt);
+    return write_stats(stats_path, rc);
+}
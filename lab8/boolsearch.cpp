@@ -4,97 +4,401 @@
 #include <cctype>
 #include <filesystem>
 #include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <memory>
+#include <algorithm>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 #include "../mystl/vector.hpp"
 #include "../mystl/hashmap.hpp"
+#include "../mystl/mmap_file.hpp"
+#include "../mystl/intern_map.hpp"
+#include "../libir/text.hpp"
+#include "../libir/codec.hpp"
+#include "../libir/index_format.hpp"
+#include "../libir/dict_fc.hpp"
+#include "../libir/setops.hpp"
+#include "../libir/stats.hpp"
 
 namespace fs = std::filesystem;
 using mystl::Vector;
+using namespace ir;
 
-struct TermInfo {
-    uint64_t offset = 0;
-    uint32_t df = 0;
+static Stat S_OPEN("index_open_seconds", STAT_NANOS, "Opening index segments.");
+static Stat S_DICT_LOAD("dict_load_seconds", STAT_NANOS, "Loading dictionaries.");
+static Stat S_QUERY("query_seconds", STAT_NANOS, "Answering queries, wall time per query.");
+static Stat S_DECODE("decode_seconds", STAT_NANOS, "Decoding whole posting lists and prefix unions.");
+static Stat S_SETOPS("setop_seconds", STAT_NANOS, "Set operations, including lists decoded lazily while intersecting.");
+static Stat S_POSITIONAL("positional_seconds", STAT_NANOS, "Phrase and NEAR matching.");
+static Stat S_ITERATE("iterate_seconds", STAT_NANOS, "Document-at-a-time evaluation (--count estimate).");
+static Stat S_RANK("rank_seconds", STAT_NANOS, "BM25 scoring of local segments.");
+static Stat S_REMOTE("remote_seconds", STAT_NANOS, "Waiting on remote shards.");
+static Stat S_QUERIES("queries", STAT_COUNT, "Queries answered, cached responses included.");
+static Stat S_QUERY_ERRORS("query_errors", STAT_COUNT, "Queries that failed to parse.");
+static Stat S_POSTINGS_DECODED("postings_decoded", STAT_COUNT, "Postings decoded from list terms.");
+static Stat S_POSTINGS_BYTES("postings_bytes_read", STAT_COUNT, "Encoded postings bytes read, bitmap terms included.");
+static Stat S_BITMAPS("bitmaps_loaded", STAT_COUNT, "Bitmap terms loaded whole.");
+static Stat S_SETOP_COUNT("setops", STAT_COUNT, "Set operations performed.");
+static Stat S_INTERMEDIATE("intermediate_docs", STAT_COUNT, "Documents in the results of AND, OR and NOT nodes.");
+static Stat S_INTERMEDIATE_MAX("intermediate_max", STAT_MAX, "Largest result of an AND, OR or NOT node.");
+static Stat S_SCORED("docs_scored", STAT_COUNT, "Documents fully scored with BM25.");
+static Stat S_REMOTE_CALLS("remote_calls", STAT_COUNT, "Requests sent to remote shards.");
+static Stat S_REMOTE_FAILURES("remote_failures", STAT_COUNT, "Remote shards that could not be reached.");
+static Stat S_RESULT_HITS("result_cache_hits", STAT_GAUGE, "Response cache hits.");
+static Stat S_RESULT_MISSES("result_cache_misses", STAT_GAUGE, "Response cache misses.");
+static Stat S_RESULT_ENTRIES("result_cache_entries", STAT_GAUGE, "Responses cached.");
+static Stat S_RESULT_BYTES("result_cache_bytes", STAT_GAUGE, "Bytes of cached responses.");
+static Stat S_PCACHE_HITS("postings_cache_hits", STAT_GAUGE, "Postings cache hits.");
+static Stat S_PCACHE_MISSES("postings_cache_misses", STAT_GAUGE, "Postings cache misses.");
+static Stat S_PCACHE_ENTRIES("postings_cache_entries", STAT_GAUGE, "Posting lists and subexpressions cached.");
+static Stat S_PCACHE_BYTES("postings_cache_bytes", STAT_GAUGE, "Bytes of cached posting lists and subexpressions.");
+
+struct TermDict {
+    mystl::MappedFile map;
+    FrontCodedDict fc;
+    bool has_fc = false;
+    const DictBinEntry* ents = nullptr;
+    const char* strs = nullptr;
+    uint32_t n = 0;
+    mystl::InternMap<TermInfo> tsv;
+
+    bool load(const fs::path& index_dir) {
+        if (map.open((index_dir / "dict.fc").string())) {
+            if (fc.open(map.data(), map.size())) { has_fc = true; return true; }
+            map.close();
+        }
+        if (map.open((index_dir / "dict.bin").string()) && map.size() >= sizeof(DictBinHeader)) {
+            const DictBinHeader* h = (const DictBinHeader*)map.data();
+            size_t need = sizeof(DictBinHeader) + sizeof(DictBinEntry) * (size_t)h->n_terms + h->strings_size;
+            if (std::memcmp(h->magic, DICT_BIN_MAGIC, 8) == 0 && map.size() >= need) {
+                ents = (const DictBinEntry*)(map.data() + sizeof(DictBinHeader));
+                strs = (const char*)(ents + h->n_terms);
+                n = h->n_terms;
+                return true;
+            }
+            map.close();
+        }
+
+        std::ifstream in(index_dir / "dict.tsv", std::ios::binary);
+        if (!in) return false;
+        size_t n_lines = (size_t)std::count(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>(), '\n');
+        in.clear();
+        in.seekg(0);
+        tsv.reserve(n_lines);
+        std::string line;
+        uint32_t ord = 0;
+        while (std::getline(in, line)) {
+            size_t p1 = line.find('\t');
+            size_t p2 = (p1==std::string::npos) ? std::string::npos : line.find('\t', p1+1);
+            if (p2 == std::string::npos) continue;
+            std::string term = line.substr(0, p1);
+            uint64_t off = std::stoull(line.substr(p1 + 1, p2 - (p1 + 1)));
+            uint32_t df = (uint32_t)std::stoul(line.substr(p2 + 1));
+            TermInfo ti; ti.offset = off; ti.df = df; ti.ord = ord++;
+            tsv.get_or_insert(term, ti) = ti;
+        }
+        return true;
+    }
+
+    bool find(const std::string& term, TermInfo& out) const {
+        if (has_fc) return fc.find(term, out);
+        if (!ents) {
+            const TermInfo* ti = tsv.find(term);
+            if (!ti) return false;
+            out = *ti;
+            return true;
+        }
+        uint32_t lo = 0, hi = n;
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            const DictBinEntry& e = ents[mid];
+            size_t m = (e.term_len < term.size()) ? e.term_len : term.size();
+            int c = std::memcmp(strs + e.term_off, term.data(), m);
+            if (c == 0) c = (e.term_len < term.size()) ? -1 : (e.term_len > term.size() ? 1 : 0);
+            if (c == 0) {
+                out.offset = e.offset;
+                out.df = e.df;
+                out.ord = mid;
+                return true;
+            }
+            if (c < 0) lo = mid + 1;
+            else hi = mid;
+        }
+        return false;
+    }
+
+    // All terms starting with `pre`; dict.tsv has no order, so that fallback scans every term.
+    void prefix(const std::string& pre, Vector<TermInfo>& out) const {
+        if (has_fc) { fc.prefix(pre, out); return; }
+        if (!ents) {
+            for (size_t i = 0; i < tsv.bucket_count(); ++i) {
+                if (tsv.used(i) && tsv.key(tsv.buckets()[i]).compare(0, pre.size(), pre) == 0) out.push_back(tsv.buckets()[i].value);
+            }
+            return;
+        }
+        uint32_t lo = 0, hi = n;
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (std::string_view(strs + ents[mid].term_off, ents[mid].term_len) < pre) lo = mid + 1;
+            else hi = mid;
+        }
+        for (; lo < n; ++lo) {
+            const DictBinEntry& e = ents[lo];
+            if (std::string_view(strs + e.term_off, e.term_len).compare(0, pre.size(), pre) != 0) break;
+            TermInfo ti; ti.offset = e.offset; ti.df = e.df; ti.ord = lo;
+            out.push_back(ti);
+        }
+    }
 };
 
-static inline char tolower_ascii(char c) {
-    if (c >= 'A' && c <= 'Z') return (char)(c - 'A' + 'a');
-    return c;
-}
+struct DocTable {
+    mystl::MappedFile map;
+    const DocsBinEntry* ents = nullptr;
+    const char* strs = nullptr;
+    uint32_t n = 0;
+    Vector<std::string> tsv;
+
+    bool load(const fs::path& index_dir) {
+        if (map.open((index_dir / "docs.bin").string()) && map.size() >= sizeof(DocsBinHeader)) {
+            const DocsBinHeader* h = (const DocsBinHeader*)map.data();
+            size_t need = sizeof(DocsBinHeader) + sizeof(DocsBinEntry) * (size_t)h->n_docs + h->strings_size;
+            if (std::memcmp(h->magic, DOCS_BIN_MAGIC, 8) == 0 && map.size() >= need) {
+                ents = (const DocsBinEntry*)(map.data() + sizeof(DocsBinHeader));
+                strs = (const char*)(ents + h->n_docs);
+                n = h->n_docs;
+                return true;
+            }
+            map.close();
+        }
 
-static bool is_word_char(char c) {
-    return std::isalnum((unsigned char)c) != 0;
+        std::ifstream in(index_dir / "docs.tsv", std::ios::binary);
+        if (!in) return false;
+        std::string line;
+        while (std::getline(in, line)) {
+            size_t p1 = line.find('\t');
+            size_t p2 = (p1==std::string::npos) ? std::string::npos : line.find('\t', p1+1);
+            if (p2 == std::string::npos) continue;
+            tsv.push_back(line.substr(p2 + 1));
+        }
+        n = (uint32_t)tsv.size();
+        return true;
+    }
+
+    uint32_t size() const { return n; }
+
+    std::string path(uint32_t id) const {
+        if (!ents) return tsv[id];
+        return std::string(strs + ents[id].path_off, ents[id].path_len);
+    }
+};
+
+struct DocSet {
+    bool bitmap = false;
+    Vector<uint32_t> ids;
+    Vector<uint64_t> words;
+    size_t count = 0;
+
+    size_t size() const { return bitmap ? count : ids.size(); }
+};
+
+static size_t bitmap_words(uint32_t n_docs) { return ((size_t)n_docs + 63) / 64; }
+
+static void bitmap_recount(DocSet& s) {
+    size_t c = 0;
+    for (size_t i = 0; i < s.words.size(); ++i) c += (size_t)__builtin_popcountll(s.words[i]);
+    s.count = c;
 }
 
-static bool ends_with(const std::string& s, const char* suf) {
-    size_t n = s.size();
-    size_t m = 0;
-    while (suf[m]) ++m;
-    if (m > n) return false;
-    for (size_t i = 0; i < m; ++i) if (s[n - m + i] != suf[i]) return false;
-    return true;
+static DocSet bitmap_zero(uint32_t n_docs) {
+    DocSet r;
+    r.bitmap = true;
+    size_t nw = bitmap_words(n_docs);
+    r.words.resize(nw);
+    return r;
 }
 
-static void stem_inplace(std::string& w) {
-    if (w.size() < 4) return;
-    if (ends_with(w, "'s") && w.size() > 3) w.resize(w.size() - 2);
+static DocSet to_bitmap(const DocSet& a, uint32_t n_docs) {
+    if (a.bitmap) return a;
+    DocSet r = bitmap_zero(n_docs);
+    for (size_t i = 0; i < a.ids.size(); ++i) {
+        uint32_t id = a.ids[i];
+        if (id < n_docs) r.words[id / 64] |= 1ULL << (id % 64);
+    }
+    bitmap_recount(r);
+    return r;
+}
 
-    if (ends_with(w, "sses") && w.size() > 6) { w.resize(w.size() - 2); return; }
-    if (ends_with(w, "ies")  && w.size() > 5) { w.resize(w.size() - 3); w.push_back('y'); return; }
-    if (ends_with(w, "s")    && w.size() > 4 && !ends_with(w, "ss")) { w.resize(w.size() - 1); }
+static void bitmap_ids(const DocSet& a, Vector<uint32_t>& out, size_t limit) {
+    for (size_t w = 0; w < a.words.size() && out.size() < limit; ++w) {
+        uint64_t bits = a.words[w];
+        while (bits && out.size() < limit) {
+            out.push_back((uint32_t)(w * 64 + (size_t)__builtin_ctzll(bits)));
+            bits &= bits - 1;
+        }
+    }
+}
 
-    if (ends_with(w, "ing") && w.size() > 6) { w.resize(w.size() - 3); return; }
-    if (ends_with(w, "ed")  && w.size() > 5) { w.resize(w.size() - 2); return; }
-    if (ends_with(w, "ly")  && w.size() > 6) { w.resize(w.size() - 2); return; }
-    if (ends_with(w, "ment") && w.size() > 8) { w.resize(w.size() - 4); return; }
+static void docset_normalize(DocSet& s, uint32_t n_docs) {
+    if (!s.bitmap && (uint64_t)s.ids.size() * 32 > n_docs) {
+        s = to_bitmap(s, n_docs);
+    } else if (s.bitmap && (uint64_t)s.count * 64 < n_docs) {
+        DocSet r;
+        r.ids.reserve(s.count);
+        bitmap_ids(s, r.ids, s.count);
+        s = std::move(r);
+    }
 }
 
-static uint32_t read_varint(std::ifstream& in) {
-    uint32_t v = 0;
-    uint32_t shift = 0;
-    for (;;) {
-        uint8_t b = 0;
-        in.read((char*)&b, 1);
-        v |= (uint32_t)(b & 0x7F) << shift;
-        if ((b & 0x80) == 0) break;
-        shift += 7;
+static DocSet docset_and(const DocSet& a, const DocSet& b, uint32_t n_docs) {
+    DocSet r;
+    if (!a.bitmap && !b.bitmap) {
+        r.ids = intersect_sorted(a.ids, b.ids);
+    } else if (a.bitmap && b.bitmap) {
+        r = bitmap_zero(n_docs);
+        for (size_t i = 0; i < r.words.size(); ++i) r.words[i] = a.words[i] & b.words[i];
+        bitmap_recount(r);
+    } else {
+        const DocSet& arr = a.bitmap ? b : a;
+        const DocSet& bm = a.bitmap ? a : b;
+        for (size_t i = 0; i < arr.ids.size(); ++i) {
+            uint32_t id = arr.ids[i];
+            if (id < n_docs && (bm.words[id / 64] >> (id % 64)) & 1ULL) r.ids.push_back(id);
+        }
     }
-    return v;
+    docset_normalize(r, n_docs);
+    return r;
 }
 
-static Vector<uint32_t> intersect_sorted(const Vector<uint32_t>& a, const Vector<uint32_t>& b) {
-    Vector<uint32_t> r;
-    size_t i = 0, j = 0;
-    while (i < a.size() && j < b.size()) {
-        uint32_t x = a[i], y = b[j];
-        if (x == y) { r.push_back(x); ++i; ++j; }
-        else if (x < y) ++i;
-        else ++j;
+static DocSet docset_or(const DocSet& a, const DocSet& b, uint32_t n_docs) {
+    DocSet r;
+    if (!a.bitmap && !b.bitmap) {
+        r.ids = union_sorted(a.ids, b.ids);
+    } else if (a.bitmap && b.bitmap) {
+        r = bitmap_zero(n_docs);
+        for (size_t i = 0; i < r.words.size(); ++i) r.words[i] = a.words[i] | b.words[i];
+        bitmap_recount(r);
+    } else {
+        const DocSet& arr = a.bitmap ? b : a;
+        r = a.bitmap ? a : b;
+        for (size_t i = 0; i < arr.ids.size(); ++i) {
+            uint32_t id = arr.ids[i];
+            if (id < n_docs) r.words[id / 64] |= 1ULL << (id % 64);
+        }
+        bitmap_recount(r);
     }
+    docset_normalize(r, n_docs);
     return r;
 }
 
-static Vector<uint32_t> union_sorted(const Vector<uint32_t>& a, const Vector<uint32_t>& b) {
-    Vector<uint32_t> r;
-    size_t i = 0, j = 0;
-    while (i < a.size() || j < b.size()) {
-        if (j >= b.size() || (i < a.size() && a[i] < b[j])) r.push_back(a[i++]);
-        else if (i >= a.size() || (j < b.size() && b[j] < a[i])) r.push_back(b[j++]);
-        else { r.push_back(a[i]); ++i; ++j; }
+static DocSet docset_not(const DocSet& a, uint32_t n_docs) {
+    DocSet r = to_bitmap(a, n_docs);
+    for (size_t i = 0; i < r.words.size(); ++i) r.words[i] = ~r.words[i];
+    if (n_docs % 64) r.words[r.words.size() - 1] &= (1ULL << (n_docs % 64)) - 1;
+    r.count = n_docs - r.count;
+    docset_normalize(r, n_docs);
+    return r;
+}
+
+static DocSet docset_andnot(const DocSet& a, const DocSet& b, uint32_t n_docs) {
+    DocSet r;
+    if (!a.bitmap && !b.bitmap) {
+        r.ids = difference_sorted(a.ids, b.ids);
+    } else if (!a.bitmap) {
+        for (size_t i = 0; i < a.ids.size(); ++i) {
+            uint32_t id = a.ids[i];
+            if (id >= n_docs || !((b.words[id / 64] >> (id % 64)) & 1ULL)) r.ids.push_back(id);
+        }
+    } else {
+        r = a;
+        if (b.bitmap) {
+            for (size_t i = 0; i < r.words.size(); ++i) r.words[i] &= ~b.words[i];
+        } else {
+            for (size_t i = 0; i < b.ids.size(); ++i) {
+                uint32_t id = b.ids[i];
+                if (id < n_docs) r.words[id / 64] &= ~(1ULL << (id % 64));
+            }
+        }
+        bitmap_recount(r);
     }
+    docset_normalize(r, n_docs);
     return r;
 }
 
-static Vector<uint32_t> complement_sorted(const Vector<uint32_t>& a, uint32_t n_docs) {
-    Vector<uint32_t> r;
-    size_t j = 0;
-    for (uint32_t id = 0; id < n_docs; ++id) {
-        if (j < a.size() && a[j] == id) ++j;
-        else r.push_back(id);
+static void docset_first(const DocSet& s, size_t k, Vector<uint32_t>& out) {
+    if (s.bitmap) { bitmap_ids(s, out, k); return; }
+    for (size_t i = 0; i < s.ids.size() && out.size() < k; ++i) out.push_back(s.ids[i]);
+}
+
+// n-ary OR. A result expected dense (or any bitmap operand) is accumulated in
+// one bitmap; otherwise the id lists are heap-merged.
+static DocSet docset_union(const Vector<const DocSet*>& sets, uint32_t n_docs) {
+    if (sets.empty()) return DocSet();
+    if (sets.size() == 1) return *sets[0];
+    if (sets.size() == 2) return docset_or(*sets[0], *sets[1], n_docs);
+    uint64_t total = 0;
+    bool dense = false;
+    for (size_t k = 0; k < sets.size(); ++k) {
+        total += sets[k]->size();
+        dense = dense || sets[k]->bitmap;
     }
+    DocSet r;
+    if (dense || total * 32 > n_docs) {
+        r = bitmap_zero(n_docs);
+        for (size_t k = 0; k < sets.size(); ++k) {
+            const DocSet& a = *sets[k];
+            if (a.bitmap) {
+                for (size_t i = 0; i < r.words.size(); ++i) r.words[i] |= a.words[i];
+                continue;
+            }
+            for (size_t i = 0; i < a.ids.size(); ++i) {
+                uint32_t id = a.ids[i];
+                if (id < n_docs) r.words[id / 64] |= 1ULL << (id % 64);
+            }
+        }
+        bitmap_recount(r);
+    } else {
+        Vector<const Vector<uint32_t>*> lists;
+        for (size_t k = 0; k < sets.size(); ++k) lists.push_back(&sets[k]->ids);
+        r.ids = union_k(lists);
+    }
+    docset_normalize(r, n_docs);
     return r;
 }
 
-enum TokenType { TT_TERM, TT_AND, TT_OR, TT_NOT, TT_LP, TT_RP };
+// Calls fn(0) .. fn(n - 1) on up to `fanout` threads, the caller's included.
+template <class Fn>
+static void scatter(size_t n, int fanout, Fn fn) {
+    if (fanout <= 1 || n <= 1) {
+        for (size_t i = 0; i < n; ++i) fn(i);
+        return;
+    }
+    std::atomic<size_t> next(0);
+    auto work = [&]() {
+        for (size_t i; (i = next++) < n;) fn(i);
+    };
+    Vector<std::thread> workers;
+    size_t extra = ((size_t)fanout < n ? (size_t)fanout : n) - 1;
+    for (size_t w = 0; w < extra; ++w) workers.emplace_back(work);
+    work();
+    for (size_t w = 0; w < workers.size(); ++w) workers[w].join();
+}
+
+
+// TT_PHRASE text is its stemmed words joined by spaces; TT_NEAR text is the distance k.
+enum TokenType { TT_TERM, TT_PREFIX, TT_PHRASE, TT_AND, TT_OR, TT_NOT, TT_NEAR, TT_LP, TT_RP };
 
 struct QToken {
     TokenType type;
@@ -103,6 +407,14 @@ struct QToken {
 
 static bool is_space(char c) { return std::isspace((unsigned char)c) != 0; }
 
+static void split_words(const std::string& text, Vector<std::string>& out) {
+    for (size_t a = 0, b; a < text.size(); a = b + 1) {
+        b = text.find(' ', a);
+        if (b == std::string::npos) b = text.size();
+        out.push_back(text.substr(a, b - a));
+    }
+}
+
 static std::string upper_word(const std::string& s) {
     std::string r;
     r.reserve(s.size());
@@ -113,27 +425,63 @@ static std::string upper_word(const std::string& s) {
     return r;
 }
 
-static void query_tokenize(const std::string& q, Vector<QToken>& out) {
+static bool is_query_char(char c) { return is_word_char(c) || c=='-' || c=='\''; }
+
+static std::string read_word(const std::string& q, size_t& i, size_t end) {
+    std::string w;
+    while (i < end && is_query_char(q[i])) w.push_back(tolower_ascii(q[i++]));
+    return w;
+}
+
+// "w1 w2 ..." becomes one TT_PHRASE of its stems (a TT_TERM if only one survives).
+static void read_phrase(const std::string& q, size_t& i, ir::StemMode stem, Vector<QToken>& out) {
+    size_t close = q.find('"', i + 1);
+    if (close == std::string::npos) close = q.size();
+    std::string phrase;
+    size_t n = 0;
+    for (size_t j = i + 1; j < close;) {
+        if (!is_query_char(q[j])) { ++j; continue; }
+        std::string w = read_word(q, j, close);
+        stem_inplace(w, stem);
+        if (w.size() < 2) continue;
+        if (n++) phrase += ' ';
+        phrase += w;
+    }
+    i = (close < q.size()) ? close + 1 : close;
+    if (n == 1) out.push_back({TT_TERM, phrase});
+    else if (n > 1) out.push_back({TT_PHRASE, phrase});
+}
+
+static void query_tokenize(const std::string& q, ir::StemMode stem, Vector<QToken>& out) {
     size_t i = 0;
     while (i < q.size()) {
         char c = q[i];
         if (is_space(c)) { ++i; continue; }
         if (c == '(') { out.push_back({TT_LP, ""}); ++i; continue; }
         if (c == ')') { out.push_back({TT_RP, ""}); ++i; continue; }
+        if (c == '"') { read_phrase(q, i, stem, out); continue; }
 
-        if (is_word_char(c) || c=='-' || c=='\'') {
-            std::string w;
-            while (i < q.size()) {
-                char cc = q[i];
-                if (is_word_char(cc) || cc=='-' || cc=='\'') { w.push_back(tolower_ascii(cc)); ++i; }
-                else break;
+        if (is_query_char(c)) {
+            std::string w = read_word(q, i, q.size());
+            if (i + 1 < q.size() && q[i] == '/' && std::isdigit((unsigned char)q[i + 1]) && upper_word(w) == "NEAR") {
+                std::string k;
+                for (++i; i < q.size() && std::isdigit((unsigned char)q[i]); ++i) {
+                    if (k.size() < 6) k.push_back(q[i]);
+                }
+                out.push_back({TT_NEAR, k});
+                continue;
+            }
+            if (i < q.size() && q[i] == '*') {
+                out.push_back({TT_PREFIX, w});
+                ++i;
+                continue;
             }
             std::string up = upper_word(w);
             if (up == "AND") out.push_back({TT_AND, ""});
             else if (up == "OR") out.push_back({TT_OR, ""});
             else if (up == "NOT") out.push_back({TT_NOT, ""});
             else {
-                stem_inplace(w);
+                stem_inplace(w, stem);
                 if (w.size() >= 2) out.push_back({TT_TERM, w});
             }
             continue;
@@ -143,19 +491,20 @@ static void query_tokenize(const std::string& q, Vector<QToken>& out) {
 }
 
 static int prec(TokenType t) {
+    if (t == TT_NEAR) return 4;
     if (t == TT_NOT) return 3;
     if (t == TT_AND) return 2;
     if (t == TT_OR)  return 1;
     return 0;
 }
 
-static bool is_op(TokenType t) { return t==TT_AND || t==TT_OR || t==TT_NOT; }
+static bool is_op(TokenType t) { return t==TT_AND || t==TT_OR || t==TT_NOT || t==TT_NEAR; }
 
 static void to_rpn(const Vector<QToken>& in, Vector<QToken>& out) {
     Vector<QToken> st;
     for (size_t i = 0; i < in.size(); ++i) {
         const QToken& tok = in[i];
-        if (tok.type == TT_TERM) out.push_back(tok);
+        if (tok.type == TT_TERM || tok.type == TT_PREFIX || tok.type == TT_PHRASE) out.push_back(tok);
         else if (is_op(tok.type)) {
             while (!st.empty() && is_op(st[st.size()-1].type) &&
                    prec(st[st.size()-1].type) >= prec(tok.type)) {
@@ -178,116 +527,2224 @@ static void to_rpn(const Vector<QToken>& in, Vector<QToken>& out) {
     }
 }
 
-static Vector<uint32_t> load_postings(std::ifstream& bin, uint64_t off, uint32_t df) {
-    Vector<uint32_t> r;
-    r.reserve(df);
-    bin.clear();
-    bin.seekg((std::streamoff)off, std::ios::beg);
+struct PostingsFile {
+    mystl::MappedFile map;
+    uint8_t version = 0;
+    uint8_t codec = CODEC_VARINT;
+
+    bool load(const fs::path& path) {
+        if (!fs::exists(path)) return false;
+        if (!map.open(path.string())) return true;
+        if (map.size() >= sizeof(PostingsHeader) && std::memcmp(map.data(), POSTINGS_MAGIC, 6) == 0) {
+            const PostingsHeader* h = (const PostingsHeader*)map.data();
+            version = h->version;
+            codec = h->codec;
+        }
+        return true;
+    }
+
+    bool supported() const { return codec == CODEC_VARINT || codec == CODEC_BP128; }
+    const uint8_t* begin() const { return (const uint8_t*)map.data(); }
+    const uint8_t* end() const { return (const uint8_t*)map.data() + map.size(); }
+};
 
+struct PostingCursor {
+    const uint8_t* skips = nullptr;
+    const uint8_t* data = nullptr;
+    const uint8_t* end = nullptr;
+    const uint8_t* p = nullptr;
+    uint8_t codec = CODEC_VARINT;
+    bool bitmap = false;
+    uint32_t n_blocks = 0;
+    uint32_t df = 0;
+    uint32_t decoded = 0;
+    uint32_t prev = 0;
+    uint32_t buf[SKIP_BLOCK];
+    uint32_t buf_n = 0;
+    uint32_t buf_i = 0;
     uint32_t cur = 0;
-    for (uint32_t i = 0; i < df; ++i) {
-        uint32_t gap = read_varint(bin);
-        cur = (i == 0) ? gap : (cur + gap);
-        r.push_back(cur);
+    uint32_t n_decoded = 0;
+    size_t n_bytes = 0;
+
+    PostingCursor(const PostingsFile& pf, const TermInfo& ti) : df(ti.df) {
+        if (!pf.map.is_open() || ti.offset >= pf.map.size()) { df = 0; return; }
+        codec = pf.codec;
+        end = pf.end();
+        data = pf.begin() + ti.offset;
+        if (pf.version >= 2 && *data++ == KIND_BITMAP) { bitmap = true; df = 0; return; }
+        if (pf.version >= 1 && df > SKIP_BLOCK) {
+            n_blocks = (df + SKIP_BLOCK - 1) / SKIP_BLOCK;
+            skips = data;
+            data += sizeof(SkipEntry) * (size_t)n_blocks;
+        }
+        p = data;
+    }
+
+    ~PostingCursor() {
+        if (!n_decoded) return;
+        S_POSTINGS_DECODED.add(n_decoded);
+        S_POSTINGS_BYTES.add(n_bytes);
+    }
+
+    PostingCursor(const PostingCursor&) = delete;
+    PostingCursor& operator=(const PostingCursor&) = delete;
+
+    SkipEntry skip(uint32_t b) const {
+        SkipEntry e;
+        std::memcpy(&e, skips + sizeof(SkipEntry) * (size_t)b, sizeof(e));
+        return e;
+    }
+
+    bool fill(bool jumped, uint32_t first_doc) {
+        uint32_t n = df - decoded;
+        if (n == 0) return false;
+        if (n > SKIP_BLOCK) n = SKIP_BLOCK;
+        const uint8_t* p0 = p;
+        if (codec == CODEC_BP128 && n == SKIP_BLOCK && p < end) {
+            uint32_t bw = *p++;
+            if (bw > 32 || (size_t)(end - p) < 16 * (size_t)bw) { df = decoded; return false; }
+            unpack128(p, bw, buf);
+            p += 16 * bw;
+            prefix_sum128(buf, jumped ? first_doc - buf[0] : prev);
+        } else {
+            uint32_t v = prev;
+            for (uint32_t i = 0; i < n; ++i) {
+                uint32_t gap = read_varint(p, end);
+                v = (i == 0 && jumped) ? first_doc : v + gap;
+                buf[i] = v;
+            }
+        }
+        buf_n = n;
+        buf_i = 0;
+        decoded += n;
+        prev = buf[n - 1];
+        n_decoded += n;
+        n_bytes += (size_t)(p - p0);
+        return true;
+    }
+
+    bool next() {
+        if (buf_i == buf_n && !fill(false, 0)) return false;
+        cur = buf[buf_i++];
+        return true;
+    }
+
+    // Rank of `cur` within the list.
+    uint32_t rank() const { return decoded - buf_n + buf_i - 1; }
+
+    // Skip block whose docID range holds d, found from the skip table alone.
+    uint32_t block_of(uint32_t d) const {
+        uint32_t lo = 0, hi = n_blocks;
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (skip(mid).first_doc <= d) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo ? lo - 1 : 0;
+    }
+
+    uint32_t block_last(uint32_t b) const { return (b + 1 < n_blocks) ? skip(b + 1).first_doc - 1 : UINT32_MAX; }
+
+    // Appends every remaining doc a block at a time.
+    void drain(Vector<uint32_t>& out) {
+        while (buf_i < buf_n || fill(false, 0)) {
+            size_t at = out.size(), n = buf_n - buf_i;
+            out.resize(at + n);
+            std::memcpy(out.data() + at, buf + buf_i, sizeof(uint32_t) * n);
+            buf_i = buf_n;
+        }
+    }
+
+    bool advance(uint32_t target) {
+        if (buf_i > 0 && cur >= target) return true;
+        uint32_t nb = decoded / SKIP_BLOCK;
+        if (n_blocks > 0 && nb < n_blocks && skip(nb).first_doc <= target) {
+            uint32_t lo = nb + 1, hi = nb + 1, step = 1;
+            while (hi < n_blocks && skip(hi).first_doc <= target) {
+                lo = hi + 1;
+                hi += step;
+                step *= 2;
+            }
+            if (hi > n_blocks) hi = n_blocks;
+            while (lo < hi) {
+                uint32_t mid = lo + (hi - lo) / 2;
+                if (skip(mid).first_doc <= target) lo = mid + 1;
+                else hi = mid;
+            }
+            uint32_t b = lo - 1;
+            SkipEntry e = skip(b);
+            p = data + e.byte_off;
+            decoded = b * SKIP_BLOCK;
+            if (!fill(true, e.first_doc)) return false;
+        }
+        for (;;) {
+            while (buf_i < buf_n) {
+                cur = buf[buf_i++];
+                if (cur >= target) return true;
+            }
+            if (!fill(false, 0)) return false;
+        }
+    }
+};
+
+static bool is_bitmap_term(const PostingsFile& pf, const TermInfo& ti) {
+    return pf.version >= 2 && pf.map.is_open() && ti.offset < pf.map.size() &&
+           pf.begin()[ti.offset] == KIND_BITMAP;
+}
+
+static DocSet load_postings(const PostingsFile& pf, const TermInfo& ti, uint32_t n_docs) {
+    DocSet r;
+    if (is_bitmap_term(pf, ti)) {
+        r = bitmap_zero(n_docs);
+        const uint8_t* p = pf.begin() + ti.offset + 1;
+        uint32_t n_words = 0;
+        if ((size_t)(pf.end() - p) >= sizeof(n_words)) std::memcpy(&n_words, p, sizeof(n_words));
+        p += sizeof(n_words);
+        size_t nw = (n_words < r.words.size()) ? n_words : r.words.size();
+        if ((size_t)(pf.end() - p) >= sizeof(uint64_t) * nw) std::memcpy(r.words.data(), p, sizeof(uint64_t) * nw);
+        S_BITMAPS.add(1);
+        S_POSTINGS_BYTES.add(sizeof(uint64_t) * nw);
+        bitmap_recount(r);
+        return r;
     }
+    r.ids.reserve(ti.df);
+    PostingCursor c(pf, ti);
+    c.drain(r.ids);
     return r;
 }
 
-static void usage() {
-    std::cout << "Usage: boolsearch --index_dir out_bool/index --query \"A AND (B OR C)\" [--topk 10]\n";
+static Vector<uint32_t> intersect_cursor(const Vector<uint32_t>& a, PostingCursor& c) {
+    Vector<uint32_t> r;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (!c.advance(a[i])) break;
+        if (c.cur == a[i]) r.push_back(a[i]);
+    }
+    return r;
 }
 
-int main(int argc, char** argv) {
-    std::string index_dir = "out_bool/index";
-    std::string query;
-    int topk = 10;
+// tf.bin view; records are addressed by TermInfo::ord.
+struct TfFile {
+    mystl::MappedFile map;
+    const char* table = nullptr;
+    uint32_t n_terms = 0;
 
-    for (int i = 1; i < argc; ++i) {
-        std::string a = argv[i];
-        if (a == "--index_dir" && i + 1 < argc) index_dir = argv[++i];
-        else if (a == "--query" && i + 1 < argc) query = argv[++i];
-        else if (a == "--topk" && i + 1 < argc) topk = std::stoi(argv[++i]);
-        else if (a == "-h" || a == "--help") { usage(); return 0; }
+    void load(const fs::path& path) {
+        if (!map.open(path.string())) return;
+        const TfHeader* h = (const TfHeader*)map.data();
+        if (map.size() < sizeof(TfHeader) || std::memcmp(h->magic, TF_MAGIC, 8) != 0 ||
+            h->table_off + sizeof(uint64_t) * (uint64_t)h->n_terms > map.size()) {
+            map.close();
+            return;
+        }
+        table = map.data() + h->table_off;
+        n_terms = h->n_terms;
     }
-    if (query.empty()) { usage(); return 1; }
 
-    Vector<std::string> doc_paths;
-    {
-        std::ifstream in(fs::path(index_dir) / "docs.tsv", std::ios::binary);
-        if (!in) { std::cerr << "Cannot open docs.tsv\n"; return 2; }
-        std::string line;
-        while (std::getline(in, line)) {
-            size_t p1 = line.find('\t');
-            size_t p2 = (p1==std::string::npos) ? std::string::npos : line.find('\t', p1+1);
-            if (p2 == std::string::npos) continue;
-            std::string path = line.substr(p2 + 1);
-            doc_paths.push_back(path);
+    bool is_open() const { return table != nullptr; }
+
+    // Start of a term's record: its block maxima, then df tf bytes.
+    const char* record(const TermInfo& ti) const {
+        if (!table || ti.ord >= n_terms) return nullptr;
+        uint64_t off;
+        std::memcpy(&off, table + sizeof(uint64_t) * (size_t)ti.ord, sizeof(off));
+        uint64_t n_blocks = (ti.df + SKIP_BLOCK - 1) / SKIP_BLOCK;
+        if (off + sizeof(TfBlockMax) * n_blocks + ti.df > map.size()) return nullptr;
+        return map.data() + off;
+    }
+};
+
+// pos.bin view; records are addressed by TermInfo::ord like tf.bin.
+struct PosFile {
+    mystl::MappedFile map;
+    const char* table = nullptr;
+    uint32_t n_terms = 0;
+    uint64_t table_off = 0;
+
+    void load(const fs::path& path) {
+        if (!map.open(path.string())) return;
+        const PosHeader* h = (const PosHeader*)map.data();
+        if (map.size() < sizeof(PosHeader) || std::memcmp(h->magic, POS_MAGIC, 8) != 0 ||
+            h->table_off + sizeof(uint64_t) * (uint64_t)h->n_terms > map.size()) {
+            map.close();
+            return;
+        }
+        table = map.data() + h->table_off;
+        n_terms = h->n_terms;
+        table_off = h->table_off;
+    }
+
+    bool is_open() const { return table != nullptr; }
+
+    uint64_t slot(uint32_t ord) const {
+        uint64_t off;
+        std::memcpy(&off, table + sizeof(uint64_t) * (size_t)ord, sizeof(off));
+        return off;
+    }
+
+    // A term's block offsets and the bounds of its position stream.
+    bool record(const TermInfo& ti, const uint8_t*& blocks, const uint8_t*& data, const uint8_t*& end) const {
+        if (!table || ti.ord >= n_terms) return false;
+        uint64_t begin = slot(ti.ord);
+        uint64_t stop = (ti.ord + 1 < n_terms) ? slot(ti.ord + 1) : table_off;
+        uint64_t head = sizeof(uint32_t) * (uint64_t)((ti.df + SKIP_BLOCK - 1) / SKIP_BLOCK);
+        if (begin + head > stop || stop > table_off) return false;
+        blocks = (const uint8_t*)map.data() + begin;
+        data = blocks + head;
+        end = (const uint8_t*)map.data() + stop;
+        return true;
+    }
+};
+
+struct DocLens {
+    mystl::MappedFile map;
+    const uint32_t* lens = nullptr;
+    uint32_t n = 0;
+    uint64_t total = 0;
+
+    void load(const fs::path& path) {
+        if (!map.open(path.string()) || map.size() < sizeof(DocLenHeader)) return;
+        const DocLenHeader* h = (const DocLenHeader*)map.data();
+        if (std::memcmp(h->magic, DOCLEN_MAGIC, 8) != 0 ||
+            sizeof(DocLenHeader) + sizeof(uint32_t) * (size_t)h->n_docs > map.size()) {
+            map.close();
+            return;
+        }
+        lens = (const uint32_t*)(map.data() + sizeof(DocLenHeader));
+        n = h->n_docs;
+        total = h->total_len;
+    }
+
+    uint32_t get(uint32_t d) const { return d < n ? lens[d] : 0; }
+};
+
+struct Index {
+    DocTable docs;
+    TermDict dict;
+    PostingsFile postings;
+    TfFile tf;
+    PosFile pos;
+    DocLens lens;
+    int decode_threads = 1;
+    uint64_t generation = 0;
+    ir::StemMode stem = ir::STEM_LIGHT;
+};
+
+// Unions with at least this many estimated postings decode their terms in parallel.
+static const uint64_t UNION_PARALLEL_MIN = 1 << 16;
+
+struct Operand {
+    bool lazy = false;
+    TermInfo ti;
+    DocSet set;
+
+    size_t size() const { return lazy ? ti.df : set.size(); }
+};
+
+static void materialize(const Index& idx, Operand& o) {
+    if (!o.lazy) return;
+    ScopedTimer timer(S_DECODE);
+    o.set = load_postings(idx.postings, o.ti, idx.docs.size());
+    o.lazy = false;
+}
+
+// Union of every term under a prefix, accumulated straight into one bitmap.
+static DocSet load_prefix(const Index& idx, const Vector<TermInfo>& terms) {
+    ScopedTimer timer(S_DECODE);
+    uint32_t n_docs = idx.docs.size();
+    if (terms.empty()) return DocSet();
+    if (terms.size() == 1) return load_postings(idx.postings, terms[0], n_docs);
+    DocSet r = bitmap_zero(n_docs);
+    for (size_t t = 0; t < terms.size(); ++t) {
+        if (is_bitmap_term(idx.postings, terms[t])) {
+            DocSet b = load_postings(idx.postings, terms[t], n_docs);
+            for (size_t i = 0; i < r.words.size(); ++i) r.words[i] |= b.words[i];
+            continue;
+        }
+        PostingCursor c(idx.postings, terms[t]);
+        while (c.next()) {
+            if (c.cur < n_docs) r.words[c.cur / 64] |= 1ULL << (c.cur % 64);
         }
     }
-    uint32_t n_docs = (uint32_t)doc_paths.size();
+    bitmap_recount(r);
+    docset_normalize(r, n_docs);
+    return r;
+}
+
+static DocSet and_operands(const Index& idx, Operand& a, Operand& b) {
+    Operand& small = (a.size() <= b.size()) ? a : b;
+    Operand& large = (a.size() <= b.size()) ? b : a;
+    materialize(idx, small);
+    S_SETOP_COUNT.add(1);
+    if (large.lazy && !small.set.bitmap && !is_bitmap_term(idx.postings, large.ti)) {
+        ScopedTimer timer(S_SETOPS);
+        PostingCursor c(idx.postings, large.ti);
+        DocSet r;
+        r.ids = intersect_cursor(small.set.ids, c);
+        return r;
+    }
+    materialize(idx, large);
+    ScopedTimer timer(S_SETOPS);
+    return docset_and(small.set, large.set, idx.docs.size());
+}
 
-    mystl::HashMap<TermInfo> dict;
+static int open_index(const fs::path& index_dir, Index& idx) {
+    ScopedTimer timer(S_OPEN);
+    if (!idx.docs.load(index_dir)) { std::cerr << "Cannot open docs.tsv\n"; return 2; }
+    bool dict_ok;
     {
-        std::ifstream in(fs::path(index_dir) / "dict.tsv", std::ios::binary);
-        if (!in) { std::cerr << "Cannot open dict.tsv\n"; return 2; }
-        std::string line;
-        while (std::getline(in, line)) {
-            size_t p1 = line.find('\t');
-            size_t p2 = (p1==std::string::npos) ? std::string::npos : line.find('\t', p1+1);
-            if (p2 == std::string::npos) continue;
-            std::string term = line.substr(0, p1);
-            uint64_t off = std::stoull(line.substr(p1 + 1, p2 - (p1 + 1)));
-            uint32_t df = (uint32_t)std::stoul(line.substr(p2 + 1));
-            TermInfo ti; ti.offset = off; ti.df = df;
-            dict.get_or_insert(term, ti) = ti;
+        ScopedTimer dict_timer(S_DICT_LOAD);
+        dict_ok = idx.dict.load(index_dir);
+    }
+    if (!dict_ok) { std::cerr << "Cannot open dict.tsv\n"; return 2; }
+    if (!idx.postings.load(index_dir / "postings.bin")) { std::cerr << "Cannot open postings.bin\n"; return 2; }
+    if (!idx.postings.supported()) { std::cerr << "Unsupported postings codec\n"; return 2; }
+    idx.tf.load(index_dir / "tf.bin");
+    idx.pos.load(index_dir / "pos.bin");
+    idx.lens.load(index_dir / "doclen.bin");
+    if (!ir::read_stem_mode(index_dir.string(), idx.stem)) { std::cerr << "Unknown stemmer in stemmer.txt\n"; return 2; }
+    // Identifies the files behind the segment: a rebuild or compaction rewrites
+    // postings.bin, while reopening an untouched segment keeps its cache entries.
+    struct stat st;
+    if (::stat((index_dir / "postings.bin").c_str(), &st) == 0) {
+        uint64_t parts[5] = {(uint64_t)st.st_dev, (uint64_t)st.st_ino, (uint64_t)st.st_size,
+                             (uint64_t)st.st_mtim.tv_sec, (uint64_t)st.st_mtim.tv_nsec};
+        idx.generation = mystl::fnv1a_64((const char*)parts, sizeof(parts));
+    }
+    return 0;
+}
+
+static DocSet andnot_operands(const Index& idx, Operand& a, Operand& b) {
+    materialize(idx, a);
+    S_SETOP_COUNT.add(1);
+    if (b.lazy && !a.set.bitmap && !is_bitmap_term(idx.postings, b.ti)) {
+        ScopedTimer timer(S_SETOPS);
+        PostingCursor c(idx.postings, b.ti);
+        DocSet r;
+        const Vector<uint32_t>& ids = a.set.ids;
+        size_t i = 0;
+        for (; i < ids.size(); ++i) {
+            if (!c.advance(ids[i])) break;
+            if (c.cur != ids[i]) r.ids.push_back(ids[i]);
         }
+        for (; i < ids.size(); ++i) r.ids.push_back(ids[i]);
+        return r;
     }
+    materialize(idx, b);
+    ScopedTimer timer(S_SETOPS);
+    return docset_andnot(a.set, b.set, idx.docs.size());
+}
 
-    std::ifstream bin(fs::path(index_dir) / "postings.bin", std::ios::binary);
-    if (!bin) { std::cerr << "Cannot open postings.bin\n"; return 2; }
+// Query plan: the RPN as a tree in which nested AND/OR chains are flattened
+// into n-ary nodes. est is an upper-bound-ish size used only for ordering.
+// Phrase and NEAR nodes keep their words' TermInfos, in order, in `expanded`.
+struct PlanNode {
+    TokenType type;
+    std::string text;
+    std::string key;
+    Vector<size_t> kids;
+    TermInfo ti;
+    bool found = false;
+    Vector<TermInfo> expanded;
+    uint64_t est = 0;
+};
 
-    Vector<QToken> qt, rpn;
-    query_tokenize(query, qt);
-    to_rpn(qt, rpn);
+// Normalized subexpression key: operands of AND/OR are sorted, so
+// "a AND b" and "b AND a" share cache entries.
+static void plan_key(const Vector<PlanNode>& nodes, PlanNode& nd) {
+    if (nd.type == TT_TERM) { nd.key = "t:" + nd.text; return; }
+    if (nd.type == TT_PREFIX) { nd.key = "p:" + nd.text; return; }
+    if (nd.type == TT_PHRASE) { nd.key = "q:" + nd.text; return; }
+    Vector<const std::string*> ks;
+    for (size_t k = 0; k < nd.kids.size(); ++k) {
+        const std::string* x = &nodes[nd.kids[k]].key;
+        size_t j = ks.size();
+        ks.push_back(x);
+        while (j > 0 && *x < *ks[j - 1]) { ks[j] = ks[j - 1]; --j; }
+        ks[j] = x;
+    }
+    if (nd.type == TT_NEAR) nd.key = "~" + nd.text + "(";
+    else nd.key = (nd.type == TT_NOT) ? "!(" : (nd.type == TT_AND ? "&(" : "|(");
+    for (size_t k = 0; k < ks.size(); ++k) {
+        if (k) nd.key += ',';
+        nd.key += *ks[k];
+    }
+    nd.key += ')';
+}
 
-    Vector< Vector<uint32_t> > st;
+static bool build_plan(const Index& idx, const Vector<QToken>& rpn, Vector<PlanNode>& nodes, size_t& root) {
+    uint64_t n_docs = idx.docs.size();
+    Vector<size_t> st;
     for (size_t i = 0; i < rpn.size(); ++i) {
         const QToken& t = rpn[i];
+        PlanNode nd;
+        nd.type = t.type;
+        nd.text = t.text;
         if (t.type == TT_TERM) {
-            const TermInfo* ti = dict.find(t.text);
-            if (!ti) {
-                Vector<uint32_t> empty;
-                st.push_back(std::move(empty));
-            } else {
-                Vector<uint32_t> pl = load_postings(bin, ti->offset, ti->df);
-                st.push_back(std::move(pl));
+            nd.found = idx.dict.find(t.text, nd.ti);
+            nd.est = nd.found ? nd.ti.df : 0;
+        } else if (t.type == TT_PREFIX) {
+            idx.dict.prefix(t.text, nd.expanded);
+            for (size_t k = 0; k < nd.expanded.size(); ++k) nd.est += nd.expanded[k].df;
+            if (nd.est > n_docs) nd.est = n_docs;
+        } else if (t.type == TT_PHRASE) {
+            Vector<std::string> words;
+            split_words(t.text, words);
+            nd.found = true;
+            nd.est = n_docs;
+            for (size_t k = 0; k < words.size(); ++k) {
+                TermInfo ti;
+                nd.found = nd.found && idx.dict.find(words[k], ti);
+                nd.expanded.push_back(ti);
+                if (ti.df < nd.est) nd.est = ti.df;
             }
+            if (!nd.found) nd.est = 0;
+        } else if (t.type == TT_NEAR) {
+            if (st.size() < 2) return false;
+            size_t b = st[st.size()-1]; st.pop_back();
+            size_t a = st[st.size()-1]; st.pop_back();
+            if (nodes[a].type != TT_TERM || nodes[b].type != TT_TERM) return false;
+            nd.kids.push_back(a);
+            nd.kids.push_back(b);
+            nd.found = nodes[a].found && nodes[b].found;
+            nd.expanded.push_back(nodes[a].ti);
+            nd.expanded.push_back(nodes[b].ti);
+            nd.est = nd.found ? std::min(nodes[a].est, nodes[b].est) : 0;
         } else if (t.type == TT_NOT) {
-            if (st.empty()) { std::cerr << "Bad query\n"; return 3; }
-            Vector<uint32_t> a = std::move(st[st.size()-1]);
+            if (st.empty()) return false;
+            nd.kids.push_back(st[st.size()-1]);
             st.pop_back();
-            Vector<uint32_t> r = complement_sorted(a, n_docs);
-            st.push_back(std::move(r));
+            nd.est = n_docs - nodes[nd.kids[0]].est;
         } else if (t.type == TT_AND || t.type == TT_OR) {
-            if (st.size() < 2) { std::cerr << "Bad query\n"; return 3; }
-            Vector<uint32_t> b = std::move(st[st.size()-1]); st.pop_back();
-            Vector<uint32_t> a = std::move(st[st.size()-1]); st.pop_back();
-            Vector<uint32_t> r = (t.type == TT_AND) ? intersect_sorted(a,b) : union_sorted(a,b);
-            st.push_back(std::move(r));
+            if (st.size() < 2) return false;
+            size_t b = st[st.size()-1]; st.pop_back();
+            size_t a = st[st.size()-1]; st.pop_back();
+            size_t ab[2] = {a, b};
+            for (size_t k = 0; k < 2; ++k) {
+                PlanNode& c = nodes[ab[k]];
+                if (c.type == t.type) {
+                    for (size_t j = 0; j < c.kids.size(); ++j) nd.kids.push_back(c.kids[j]);
+                } else {
+                    nd.kids.push_back(ab[k]);
+                }
+            }
+            nd.est = (t.type == TT_AND) ? n_docs : 0;
+            for (size_t k = 0; k < nd.kids.size(); ++k) {
+                const PlanNode& c = nodes[nd.kids[k]];
+                if (t.type == TT_OR) nd.est += c.est;
+                else if (c.type != TT_NOT && c.est < nd.est) nd.est = c.est;
+            }
+            if (nd.est > n_docs) nd.est = n_docs;
+        } else {
+            continue;
         }
+        plan_key(nodes, nd);
+        nodes.push_back(std::move(nd));
+        st.push_back(nodes.size() - 1);
     }
+    if (st.size() != 1) return false;
+    root = st[0];
+    return true;
+}
 
-    if (st.size() != 1) { std::cerr << "Bad query\n"; return 3; }
-    Vector<uint32_t> res = std::move(st[0]);
+static void sort_by_est(Vector<size_t>& v, const Vector<PlanNode>& nodes) {
+    for (size_t i = 1; i < v.size(); ++i) {
+        size_t x = v[i], j = i;
+        while (j > 0 && nodes[v[j - 1]].est > nodes[x].est) { v[j] = v[j - 1]; --j; }
+        v[j] = x;
+    }
+}
 
-    std::cout << "hits: " << res.size() << "\n";
-    int shown = 0;
-    for (size_t i = 0; i < res.size() && shown < topk; ++i) {
-        uint32_t id = res[i];
-        if (id < doc_paths.size()) {
-            std::cout << id << "\t" << doc_paths[id] << "\n";
-            ++shown;
+// Bounded LRU split into stripes by key hash, each with its own mutex, list and
+// share of the byte budget, so concurrent requests rarely contend. Values are
+// copied in and out, which keeps the critical sections short.
+template <class V>
+class LruCache {
+public:
+    explicit LruCache(size_t budget_bytes, size_t n_stripes = 16) {
+        for (size_t i = 0; i < n_stripes; ++i) {
+            stripes_.emplace_back(new Stripe());
+            stripes_[i]->budget = budget_bytes / n_stripes;
         }
     }
-    return 0;
+
+    bool get(const std::string& key, V& out) {
+        Stripe& st = stripe(key);
+        std::lock_guard<std::mutex> lock(st.mu);
+        const size_t* at = st.where.find(key);
+        if (!at) { ++st.misses; return false; }
+        ++st.hits;
+        size_t i = *at;
+        st.unlink(i);
+        st.push_front(i);
+        out = st.slots[i].value;
+        return true;
+    }
+
+    void put(const std::string& key, const V& value, size_t bytes) {
+        Stripe& st = stripe(key);
+        bytes += key.size() + 64;
+        if (bytes > st.budget / 4) return;
+        std::lock_guard<std::mutex> lock(st.mu);
+        if (st.where.find(key)) return;
+        while (st.used + bytes > st.budget && st.tail != NIL) st.evict(st.tail);
+        size_t i;
+        if (!st.free.empty()) { i = st.free[st.free.size() - 1]; st.free.pop_back(); }
+        else { i = st.slots.size(); st.slots.emplace_back(); }
+        Entry& e = st.slots[i];
+        e.key = key;
+        e.value = value;
+        e.bytes = bytes;
+        st.used += bytes;
+        ++st.entries;
+        st.where.get_or_insert(key, i) = i;
+        st.push_front(i);
+    }
+
+    // Drops every entry whose key satisfies drop(key); returns how many.
+    template <class Pred>
+    size_t erase_if(Pred drop) {
+        size_t n = 0;
+        for (size_t s = 0; s < stripes_.size(); ++s) {
+            Stripe& st = *stripes_[s];
+            std::lock_guard<std::mutex> lock(st.mu);
+            for (size_t i = st.head; i != NIL;) {
+                size_t next = st.slots[i].next;
+                if (drop(st.slots[i].key)) { st.evict(i); ++n; }
+                i = next;
+            }
+        }
+        return n;
+    }
+
+    size_t hits() const { return sum(&Stripe::hits); }
+    size_t misses() const { return sum(&Stripe::misses); }
+    size_t entries() const { return sum(&Stripe::entries); }
+    size_t bytes() const { return sum(&Stripe::used); }
+
+private:
+    static const size_t NIL = (size_t)-1;
+
+    struct Entry {
+        std::string key;
+        V value;
+        size_t bytes = 0;
+        size_t prev = NIL;
+        size_t next = NIL;
+    };
+
+    struct Stripe {
+        std::mutex mu;
+        mystl::HashMap<size_t> where;
+        Vector<Entry> slots;
+        Vector<size_t> free;
+        size_t head = NIL;
+        size_t tail = NIL;
+        size_t budget = 0;
+        std::atomic<size_t> used{0}, entries{0}, hits{0}, misses{0};
+
+        void unlink(size_t i) {
+            Entry& e = slots[i];
+            if (e.prev != NIL) slots[e.prev].next = e.next; else head = e.next;
+            if (e.next != NIL) slots[e.next].prev = e.prev; else tail = e.prev;
+            e.prev = e.next = NIL;
+        }
+
+        void push_front(size_t i) {
+            Entry& e = slots[i];
+            e.prev = NIL;
+            e.next = head;
+            if (head != NIL) slots[head].prev = i;
+            head = i;
+            if (tail == NIL) tail = i;
+        }
+
+        void evict(size_t i) {
+            unlink(i);
+            Entry& e = slots[i];
+            where.erase(e.key);
+            used -= e.bytes;
+            --entries;
+            e.key.clear();
+            e.value = V();
+            free.push_back(i);
+        }
+    };
+
+    Stripe& stripe(const std::string& key) {
+        return *stripes_[mystl::fnv1a_64(key.data(), key.size()) % stripes_.size()];
+    }
+
+    size_t sum(std::atomic<size_t> Stripe::* field) const {
+        size_t n = 0;
+        for (size_t s = 0; s < stripes_.size(); ++s) n += (*stripes_[s].*field).load();
+        return n;
+    }
+
+    Vector< std::unique_ptr<Stripe> > stripes_;
+};
+
+static size_t docset_bytes(const DocSet& s) {
+    return sizeof(uint32_t) * s.ids.size() + sizeof(uint64_t) * s.words.size();
+}
+
+// `postings` holds decoded lists and subexpression sets keyed by
+// "<segment generation>|<plan key>"; `results` holds whole responses keyed by
+// "<set generation>|<mode>|<topk>|<normalized RPN>". A quarter of the budget
+// goes to responses.
+struct QueryCache {
+    LruCache<DocSet> postings;
+    LruCache<std::string> results;
+
+    explicit QueryCache(size_t budget_bytes) : postings(budget_bytes - budget_bytes / 4), results(budget_bytes / 4) {}
+};
+
+static Operand eval_node(const Index& idx, const Vector<PlanNode>& nodes, size_t i, QueryCache* cache);
+static DocSet eval_positional(const Index& idx, const PlanNode& nd);
+
+static Operand eval_node_uncached(const Index& idx, const Vector<PlanNode>& nodes, size_t i, QueryCache* cache) {
+    const PlanNode& nd = nodes[i];
+    uint32_t n_docs = idx.docs.size();
+    Operand r;
+    if (nd.type == TT_TERM) {
+        if (nd.found) { r.ti = nd.ti; r.lazy = true; }
+        return r;
+    }
+    if (nd.type == TT_PREFIX) {
+        r.set = load_prefix(idx, nd.expanded);
+        return r;
+    }
+    if (nd.type == TT_PHRASE || nd.type == TT_NEAR) {
+        r.set = eval_positional(idx, nd);
+        return r;
+    }
+    if (nd.type == TT_NOT) {
+        Operand a = eval_node(idx, nodes, nd.kids[0], cache);
+        materialize(idx, a);
+        ScopedTimer timer(S_SETOPS);
+        S_SETOP_COUNT.add(1);
+        r.set = docset_not(a.set, n_docs);
+        return r;
+    }
+    if (nd.type == TT_OR) {
+        // Plain terms stay lazy until every operand is known; a large union
+        // decodes them on idx.decode_threads threads, then merges once.
+        Vector<Operand> ops;
+        ops.resize(nd.kids.size());
+        for (size_t k = 0; k < nd.kids.size(); ++k) {
+            ops[k] = eval_node(idx, nodes, nd.kids[k], cache);
+            if (!ops[k].lazy && ops[k].set.size() == n_docs) return std::move(ops[k]);
+        }
+        int threads = (nd.est >= UNION_PARALLEL_MIN) ? idx.decode_threads : 1;
+        scatter(ops.size(), threads, [&](size_t k) { materialize(idx, ops[k]); });
+        Vector<const DocSet*> sets;
+        for (size_t k = 0; k < ops.size(); ++k) sets.push_back(&ops[k].set);
+        ScopedTimer timer(S_SETOPS);
+        S_SETOP_COUNT.add(1);
+        r.set = docset_union(sets, n_docs);
+        return r;
+    }
+
+    // AND: rarest positive operand first, each NOT child applied as a difference at the end.
+    Vector<size_t> pos, neg;
+    for (size_t k = 0; k < nd.kids.size(); ++k) {
+        size_t c = nd.kids[k];
+        if (nodes[c].type == TT_NOT) neg.push_back(nodes[c].kids[0]);
+        else pos.push_back(c);
+    }
+    sort_by_est(pos, nodes);
+    sort_by_est(neg, nodes);
+    if (pos.empty()) {
+        Vector<Operand> ops;
+        ops.resize(neg.size());
+        Vector<const DocSet*> sets;
+        for (size_t k = 0; k < neg.size(); ++k) {
+            ops[k] = eval_node(idx, nodes, neg[k], cache);
+            materialize(idx, ops[k]);
+            sets.push_back(&ops[k].set);
+        }
+        ScopedTimer timer(S_SETOPS);
+        S_SETOP_COUNT.add(2);
+        r.set = docset_not(docset_union(sets, n_docs), n_docs);
+        return r;
+    }
+    r = eval_node(idx, nodes, pos[0], cache);
+    for (size_t k = 1; k < pos.size() && r.size() > 0; ++k) {
+        Operand b = eval_node(idx, nodes, pos[k], cache);
+        r.set = and_operands(idx, r, b);
+        r.lazy = false;
+    }
+    for (size_t k = 0; k < neg.size() && r.size() > 0; ++k) {
+        Operand b = eval_node(idx, nodes, neg[k], cache);
+        r.set = andnot_operands(idx, r, b);
+        r.lazy = false;
+    }
+    return r;
+}
+
+static Operand note_result(const PlanNode& nd, Operand r) {
+    if (nd.type == TT_AND || nd.type == TT_OR || nd.type == TT_NOT) {
+        S_INTERMEDIATE.add(r.size());
+        S_INTERMEDIATE_MAX.max(r.size());
+    }
+    return r;
+}
+
+// With a cache, every found term and every operator node is materialized and
+// memoized; lazy cursor intersection is traded for reuse across queries.
+static Operand eval_node(const Index& idx, const Vector<PlanNode>& nodes, size_t i, QueryCache* cache) {
+    const PlanNode& nd = nodes[i];
+    if (!cache || (nd.type == TT_TERM && !nd.found)) return note_result(nd, eval_node_uncached(idx, nodes, i, cache));
+    std::string key = std::to_string(idx.generation) + '|' + nd.key;
+    Operand r;
+    if (cache->postings.get(key, r.set)) return r;
+    r = note_result(nd, eval_node_uncached(idx, nodes, i, cache));
+    materialize(idx, r);
+    cache->postings.put(key, r.set, docset_bytes(r.set));
+    return r;
+}
+
+static bool eval_rpn(const Index& idx, const Vector<QToken>& rpn, DocSet& res, QueryCache* cache = nullptr) {
+    Vector<PlanNode> nodes;
+    size_t root = 0;
+    if (!build_plan(idx, rpn, nodes, root)) return false;
+    Operand r = eval_node(idx, nodes, root, cache);
+    materialize(idx, r);
+    res = std::move(r.set);
+    return true;
+}
+
+// Document-at-a-time evaluation: a pull-based iterator tree over the encoded
+// postings, so the first k matches come out without decoding whole lists.
+// next() moves to the following match; advance(t) to the first match >= t.
+struct DocIter {
+    uint32_t doc = 0;
+    bool started = false;
+    virtual ~DocIter() {}
+    virtual bool next() = 0;
+    virtual bool advance(uint32_t target) = 0;
+};
+
+typedef std::unique_ptr<DocIter> IterPtr;
+
+struct TermIter : DocIter {
+    PostingCursor c;
+    TermIter(const PostingsFile& pf, const TermInfo& ti) : c(pf, ti) {}
+    bool next() override {
+        if (!c.next()) return false;
+        doc = c.cur;
+        started = true;
+        return true;
+    }
+    bool advance(uint32_t target) override {
+        if (started && doc >= target) return true;
+        if (!c.advance(target)) return false;
+        doc = c.cur;
+        started = true;
+        return true;
+    }
+};
+
+// Walks set bits of a bitmap term straight from the mmapped postings.bin.
+struct BitmapIter : DocIter {
+    const uint8_t* words;
+    size_t n_words;
+    uint32_t n_docs;
+    BitmapIter(const uint8_t* w, size_t nw, uint32_t n) : words(w), n_words(nw), n_docs(n) {}
+    bool scan(uint64_t from) {
+        size_t w = (size_t)(from / 64);
+        if (w >= n_words) return false;
+        uint64_t bits;
+        std::memcpy(&bits, words + 8 * w, 8);
+        bits &= ~0ULL << (from % 64);
+        while (!bits) {
+            if (++w >= n_words) return false;
+            std::memcpy(&bits, words + 8 * w, 8);
+        }
+        uint64_t d = (uint64_t)w * 64 + (uint64_t)__builtin_ctzll(bits);
+        if (d >= n_docs) return false;
+        doc = (uint32_t)d;
+        started = true;
+        return true;
+    }
+    bool next() override { return scan(started ? (uint64_t)doc + 1 : 0); }
+    bool advance(uint32_t target) override {
+        if (started && doc >= target) return true;
+        return scan(target);
+    }
+};
+
+// Leapfrog intersection; kids are ordered rarest first, so kids[0] drives.
+// A candidate is dropped if any of `negs` contains it.
+struct AndIter : DocIter {
+    Vector<IterPtr> kids;
+    Vector<IterPtr> negs;
+    Vector<bool> neg_done;
+
+    bool align(uint32_t cand) {
+        for (;;) {
+            bool moved = false;
+            for (size_t k = 0; k < kids.size(); ++k) {
+                if (!kids[k]->advance(cand)) return false;
+                if (kids[k]->doc > cand) { cand = kids[k]->doc; moved = true; }
+            }
+            if (moved) continue;
+            bool excluded = false;
+            for (size_t k = 0; k < negs.size() && !excluded; ++k) {
+                if (neg_done[k]) continue;
+                if (!negs[k]->advance(cand)) { neg_done[k] = true; continue; }
+                excluded = negs[k]->doc == cand;
+            }
+            if (!excluded) break;
+            if (cand == UINT32_MAX) return false;
+            ++cand;
+        }
+        doc = cand;
+        started = true;
+        return true;
+    }
+    bool next() override {
+        if (!started) return kids[0]->next() && align(kids[0]->doc);
+        if (doc == UINT32_MAX) return false;
+        return align(doc + 1);
+    }
+    bool advance(uint32_t target) override {
+        if (started && doc >= target) return true;
+        return align(target);
+    }
+};
+
+// Live kids sit in a binary min-heap keyed by their current doc, so a step
+// costs O(log k) in the number of ORed operands; exhausted kids drop out.
+struct OrIter : DocIter {
+    Vector<IterPtr> kids;
+    Vector<size_t> heap;
+
+    bool less(size_t a, size_t b) const { return kids[heap[a]]->doc < kids[heap[b]]->doc; }
+    void sift_down(size_t i) {
+        for (;;) {
+            size_t l = 2 * i + 1, r = l + 1, m = i;
+            if (l < heap.size() && less(l, m)) m = l;
+            if (r < heap.size() && less(r, m)) m = r;
+            if (m == i) return;
+            size_t tmp = heap[i]; heap[i] = heap[m]; heap[m] = tmp;
+            i = m;
+        }
+    }
+    // Re-seats the top kid after it moved, or drops it if it ran out.
+    void reseat(bool alive) {
+        if (!alive) {
+            heap[0] = heap[heap.size() - 1];
+            heap.pop_back();
+        }
+        sift_down(0);
+    }
+    bool settle() {
+        if (heap.empty()) return false;
+        doc = kids[heap[0]]->doc;
+        return true;
+    }
+    bool start(bool seek, uint32_t target) {
+        started = true;
+        for (size_t k = 0; k < kids.size(); ++k) {
+            if (seek ? kids[k]->advance(target) : kids[k]->next()) heap.push_back(k);
+        }
+        for (size_t i = heap.size() / 2; i-- > 0;) sift_down(i);
+        return settle();
+    }
+    bool next() override {
+        if (!started) return start(false, 0);
+        while (!heap.empty() && kids[heap[0]]->doc == doc) reseat(kids[heap[0]]->next());
+        return settle();
+    }
+    bool advance(uint32_t target) override {
+        if (!started) return start(true, target);
+        if (doc >= target) return !heap.empty();
+        while (!heap.empty() && kids[heap[0]]->doc < target) reseat(kids[heap[0]]->advance(target));
+        return settle();
+    }
+};
+
+struct NotIter : DocIter {
+    IterPtr kid;
+    bool kid_done;
+    uint32_t n_docs;
+    NotIter(IterPtr k, uint32_t n) : kid(std::move(k)), kid_done(!kid), n_docs(n) {}
+
+    bool from(uint64_t cand) {
+        for (; cand < n_docs; ++cand) {
+            if (!kid_done && !kid->advance((uint32_t)cand)) kid_done = true;
+            if (kid_done || kid->doc != cand) {
+                doc = (uint32_t)cand;
+                started = true;
+                return true;
+            }
+        }
+        return false;
+    }
+    bool next() override { return from(started ? (uint64_t)doc + 1 : 0); }
+    bool advance(uint32_t target) override {
+        if (started && doc >= target) return true;
+        return from(target);
+    }
+};
+
+static IterPtr term_iter(const Index& idx, const TermInfo& ti) {
+    if (is_bitmap_term(idx.postings, ti)) {
+        const uint8_t* p = idx.postings.begin() + ti.offset + 1;
+        uint32_t n_words = 0;
+        if ((size_t)(idx.postings.end() - p) < sizeof(n_words)) return nullptr;
+        std::memcpy(&n_words, p, sizeof(n_words));
+        p += sizeof(n_words);
+        size_t nw = (size_t)(idx.postings.end() - p) / 8;
+        if (n_words < nw) nw = n_words;
+        return IterPtr(new BitmapIter(p, nw, idx.docs.size()));
+    }
+    return IterPtr(new TermIter(idx.postings, ti));
+}
+
+// A term's iterator that also tracks the rank of its current doc within the
+// posting list, which addresses the term's tf.bin and pos.bin data. Bitmap
+// ranks are counted forward incrementally.
+struct TermCursor {
+    IterPtr it;
+    TermIter* list = nullptr;
+    BitmapIter* bits = nullptr;
+    size_t rank_w = 0;
+    uint32_t rank_base = 0;
+
+    bool open(const Index& idx, const TermInfo& ti) {
+        it = term_iter(idx, ti);
+        if (!it) return false;
+        if (is_bitmap_term(idx.postings, ti)) bits = (BitmapIter*)it.get();
+        else list = (TermIter*)it.get();
+        return true;
+    }
+
+    uint32_t doc() const { return it->doc; }
+    bool next() { return it->next(); }
+    bool advance(uint32_t target) { return it->advance(target); }
+
+    uint64_t word(size_t i) const {
+        uint64_t x;
+        std::memcpy(&x, bits->words + 8 * i, 8);
+        return x;
+    }
+
+    uint32_t rank() {
+        if (list) return list->c.rank();
+        size_t wi = doc() / 64;
+        for (; rank_w < wi; ++rank_w) rank_base += (uint32_t)__builtin_popcountll(word(rank_w));
+        return rank_base + (uint32_t)__builtin_popcountll(word(wi) & ((1ULL << (doc() % 64)) - 1));
+    }
+};
+
+// Phrase (consecutive positions, in order) or NEAR/k (two words within k
+// positions, either order; build_plan rejects any other operand). Candidates come from a leapfrog intersection of
+// docIDs; positions are decoded only for those, starting from the pos.bin
+// block of the candidate's posting or from the previous posting in it.
+struct PositionIter : DocIter {
+    struct Term {
+        TermCursor c;
+        const uint8_t* blocks = nullptr;
+        const uint8_t* data = nullptr;
+        const uint8_t* end = nullptr;
+        uint32_t last_rank = 0;
+        const uint8_t* last_p = nullptr;
+        Vector<uint32_t> pos;
+
+        void load() {
+            uint32_t r = c.rank();
+            const uint8_t* p;
+            uint32_t skip;
+            if (last_p && last_rank <= r && last_rank / SKIP_BLOCK == r / SKIP_BLOCK) {
+                p = last_p;
+                skip = r - last_rank;
+            } else {
+                uint32_t off;
+                std::memcpy(&off, blocks + sizeof(uint32_t) * (size_t)(r / SKIP_BLOCK), sizeof(off));
+                p = ((size_t)(end - data) >= off) ? data + off : end;
+                skip = r % SKIP_BLOCK;
+            }
+            for (; skip && p < end; --skip) {
+                const uint8_t* z = (const uint8_t*)std::memchr(p, 0, (size_t)(end - p));
+                p = z ? z + 1 : end;
+            }
+            last_rank = r;
+            last_p = p;
+            pos.clear();
+            uint32_t v = 0;
+            while (p < end) {
+                uint32_t d = read_varint(p, end);
+                if (!d) break;
+                v = pos.empty() ? d - 1 : v + d;
+                pos.push_back(v);
+            }
+        }
+    };
+
+    Vector<Term> terms;
+    Vector<size_t> at;
+    uint32_t near = 0;
+    bool phrase = true;
+
+    bool match() {
+        for (size_t t = 0; t < terms.size(); ++t) terms[t].load();
+        if (!phrase) {
+            const Vector<uint32_t>& a = terms[0].pos;
+            const Vector<uint32_t>& b = terms[1].pos;
+            size_t i = 0, j = 0;
+            // Two different terms never share a position, so equal positions only
+            // occur for "x NEAR/k x", where they are the same occurrence.
+            while (i < a.size() && j < b.size()) {
+                uint32_t x = a[i], y = b[j];
+                if (x != y && (x > y ? x - y : y - x) <= near) return true;
+                if (x < y) ++i;
+                else ++j;
+            }
+            return false;
+        }
+        at.clear();
+        at.resize(terms.size());
+        const Vector<uint32_t>& first = terms[0].pos;
+        for (size_t i = 0; i < first.size(); ++i) {
+            bool ok = true;
+            for (size_t t = 1; t < terms.size() && ok; ++t) {
+                const Vector<uint32_t>& v = terms[t].pos;
+                uint64_t want = (uint64_t)first[i] + t;
+                while (at[t] < v.size() && v[at[t]] < want) ++at[t];
+                ok = at[t] < v.size() && v[at[t]] == want;
+            }
+            if (ok) return true;
+        }
+        return false;
+    }
+
+    bool align(uint32_t cand) {
+        for (;;) {
+            bool moved = false;
+            for (size_t t = 0; t < terms.size(); ++t) {
+                if (!terms[t].c.advance(cand)) return false;
+                if (terms[t].c.doc() > cand) { cand = terms[t].c.doc(); moved = true; }
+            }
+            if (moved) continue;
+            if (match()) break;
+            if (cand == UINT32_MAX) return false;
+            ++cand;
+        }
+        doc = cand;
+        started = true;
+        return true;
+    }
+    bool next() override {
+        if (!started) return align(0);
+        if (doc == UINT32_MAX) return false;
+        return align(doc + 1);
+    }
+    bool advance(uint32_t target) override {
+        if (started && doc >= target) return true;
+        return align(target);
+    }
+};
+
+// Without pos.bin a phrase or NEAR degrades to the AND of its words.
+static IterPtr position_iter(const Index& idx, const PlanNode& nd) {
+    if (!nd.found || nd.expanded.empty()) return nullptr;
+    if (!idx.pos.is_open()) {
+        std::unique_ptr<AndIter> it(new AndIter());
+        for (size_t k = 0; k < nd.expanded.size(); ++k) {
+            IterPtr c = term_iter(idx, nd.expanded[k]);
+            if (!c) return nullptr;
+            it->kids.push_back(std::move(c));
+        }
+        return IterPtr(it.release());
+    }
+    std::unique_ptr<PositionIter> it(new PositionIter());
+    it->phrase = nd.type == TT_PHRASE;
+    if (!it->phrase) it->near = (uint32_t)std::stoul(nd.text);
+    for (size_t k = 0; k < nd.expanded.size(); ++k) {
+        PositionIter::Term t;
+        if (!idx.pos.record(nd.expanded[k], t.blocks, t.data, t.end) || !t.c.open(idx, nd.expanded[k])) return nullptr;
+        it->terms.push_back(std::move(t));
+    }
+    return IterPtr(it.release());
+}
+
+static DocSet eval_positional(const Index& idx, const PlanNode& nd) {
+    ScopedTimer timer(S_POSITIONAL);
+    DocSet r;
+    IterPtr it = position_iter(idx, nd);
+    while (it && it->next()) r.ids.push_back(it->doc);
+    docset_normalize(r, idx.docs.size());
+    return r;
+}
+
+// Builds the iterator for a plan node; nullptr stands for the empty set.
+static IterPtr make_iter(const Index& idx, const Vector<PlanNode>& nodes, size_t i) {
+    const PlanNode& nd = nodes[i];
+    uint32_t n_docs = idx.docs.size();
+    if (nd.type == TT_TERM) return nd.found ? term_iter(idx, nd.ti) : nullptr;
+    if (nd.type == TT_PHRASE || nd.type == TT_NEAR) return position_iter(idx, nd);
+    if (nd.type == TT_PREFIX) {
+        if (nd.expanded.empty()) return nullptr;
+        if (nd.expanded.size() == 1) return term_iter(idx, nd.expanded[0]);
+        std::unique_ptr<OrIter> it(new OrIter());
+        for (size_t k = 0; k < nd.expanded.size(); ++k) {
+            IterPtr c = term_iter(idx, nd.expanded[k]);
+            if (!c) continue;
+            it->kids.push_back(std::move(c));
+        }
+        return IterPtr(it.release());
+    }
+    if (nd.type == TT_NOT) return IterPtr(new NotIter(make_iter(idx, nodes, nd.kids[0]), n_docs));
+
+    if (nd.type == TT_OR) {
+        std::unique_ptr<OrIter> it(new OrIter());
+        for (size_t k = 0; k < nd.kids.size(); ++k) {
+            IterPtr c = make_iter(idx, nodes, nd.kids[k]);
+            if (!c) continue;
+            it->kids.push_back(std::move(c));
+        }
+        if (it->kids.empty()) return nullptr;
+        if (it->kids.size() == 1) return std::move(it->kids[0]);
+        return IterPtr(it.release());
+    }
+
+    Vector<size_t> pos, neg;
+    for (size_t k = 0; k < nd.kids.size(); ++k) {
+        size_t c = nd.kids[k];
+        if (nodes[c].type == TT_NOT) neg.push_back(nodes[c].kids[0]);
+        else pos.push_back(c);
+    }
+    sort_by_est(pos, nodes);
+    if (pos.empty()) {
+        std::unique_ptr<OrIter> u(new OrIter());
+        for (size_t k = 0; k < neg.size(); ++k) {
+            IterPtr c = make_iter(idx, nodes, neg[k]);
+            if (!c) continue;
+            u->kids.push_back(std::move(c));
+        }
+        return IterPtr(new NotIter(u->kids.empty() ? nullptr : IterPtr(u.release()), n_docs));
+    }
+    std::unique_ptr<AndIter> it(new AndIter());
+    for (size_t k = 0; k < pos.size(); ++k) {
+        IterPtr c = make_iter(idx, nodes, pos[k]);
+        if (!c) return nullptr;
+        it->kids.push_back(std::move(c));
+    }
+    for (size_t k = 0; k < neg.size(); ++k) {
+        IterPtr c = make_iter(idx, nodes, neg[k]);
+        if (!c) continue;
+        it->negs.push_back(std::move(c));
+        it->neg_done.push_back(false);
+    }
+    return IterPtr(it.release());
+}
+
+static const size_t ESTIMATE_SAMPLE = 100;
+
+// Pulls the first `k` matches; `hits` is exact if the iterator ran dry within
+// max(k, ESTIMATE_SAMPLE) matches, else extrapolated from how far into the docID
+// space the sample reached.
+static bool eval_first(const Index& idx, const Vector<QToken>& rpn, size_t k, Vector<uint32_t>& out, size_t& hits) {
+    ScopedTimer timer(S_ITERATE);
+    Vector<PlanNode> nodes;
+    size_t root = 0;
+    if (!build_plan(idx, rpn, nodes, root)) return false;
+    IterPtr it = make_iter(idx, nodes, root);
+    hits = 0;
+    if (!it) return true;
+    size_t want = (k > ESTIMATE_SAMPLE) ? k : ESTIMATE_SAMPLE;
+    while (hits < want && it->next()) {
+        if (out.size() < k) out.push_back(it->doc);
+        ++hits;
+    }
+    if (hits == want && it->next()) {
+        hits = (size_t)((double)hits * (double)idx.docs.size() / ((double)it->doc + 1.0));
+        if (hits <= want) hits = want + 1;
+    }
+    return true;
+}
+
+static bool write_all(int fd, const std::string& s) {
+    size_t done = 0;
+    while (done < s.size()) {
+        ssize_t w = ::write(fd, s.data() + done, s.size() - done);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+        done += (size_t)w;
+    }
+    return true;
+}
+
+// A shard served by another `boolsearch --serve` ("unix:/path" or "host:port").
+// Requests on one connection are serialized; a broken connection is reopened
+// once per request.
+struct RemoteShard {
+    std::string spec;
+    uint32_t base = 0;
+    uint32_t n_docs = 0;
+    std::string mode;
+    int fd = -1;
+    std::string buf;
+    size_t at = 0;
+    std::mutex mu;
+
+    ~RemoteShard() { if (fd >= 0) ::close(fd); }
+};
+
+static int connect_shard(const std::string& spec) {
+    if (spec.compare(0, 5, "unix:") == 0) {
+        std::string path = spec.substr(5);
+        sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) return -1;
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        if (::connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) { ::close(fd); return -1; }
+        return fd;
+    }
+    size_t colon = spec.rfind(':');
+    if (colon == std::string::npos) return -1;
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)std::atoi(spec.c_str() + colon + 1));
+    if (::inet_pton(AF_INET, spec.substr(0, colon).c_str(), &addr.sin_addr) != 1) return -1;
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (::connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) { ::close(fd); return -1; }
+    return fd;
+}
+
+static bool read_line(RemoteShard& r, std::string& line) {
+    char chunk[4096];
+    for (;;) {
+        size_t nl = r.buf.find('\n', r.at);
+        if (nl != std::string::npos) {
+            line.assign(r.buf, r.at, nl - r.at);
+            r.at = nl + 1;
+            return true;
+        }
+        r.buf.erase(0, r.at);
+        r.at = 0;
+        ssize_t n = ::read(r.fd, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        r.buf.append(chunk, (size_t)n);
+    }
+}
+
+// Sends one request line and reads the reply: the "OK <a> <n>" header and its n
+// lines. An "ERR" reply comes back as the header; false means the shard is unreachable.
+static bool remote_call(RemoteShard& r, const std::string& request, std::string& head, Vector<std::string>& lines) {
+    ScopedTimer timer(S_REMOTE);
+    S_REMOTE_CALLS.add(1);
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        if (r.fd < 0) {
+            r.fd = connect_shard(r.spec);
+            r.buf.clear();
+            r.at = 0;
+        }
+        if (r.fd < 0) return false;
+        lines.clear();
+        bool ok = write_all(r.fd, request) && read_line(r, head);
+        if (ok && head.compare(0, 3, "OK ") == 0) {
+            size_t sp = head.find(' ', 3);
+            size_t n = (sp == std::string::npos) ? 0 : (size_t)std::strtoull(head.c_str() + sp + 1, nullptr, 10);
+            std::string line;
+            for (size_t i = 0; ok && i < n; ++i) {
+                ok = read_line(r, line);
+                if (ok) lines.push_back(line);
+            }
+        }
+        if (ok) return true;
+        ::close(r.fd);
+        r.fd = -1;
+    }
+    S_REMOTE_FAILURES.add(1);
+    return false;
+}
+
+// Remote shards take docIDs after all local segments, in --remote order; a
+// query runs on up to `fanout` segments and shards at once.
+struct IndexSet {
+    Vector< std::unique_ptr<Index> > segs;
+    Vector<uint32_t> bases;
+    uint32_t n_docs = 0;
+    Vector< std::unique_ptr<RemoteShard> > remotes;
+    int fanout = 1;
+    uint64_t generation = 0;
+    ir::StemMode stem = ir::STEM_LIGHT;
+};
+
+static uint32_t total_docs(const IndexSet& set) {
+    if (set.remotes.empty()) return set.n_docs;
+    const RemoteShard& r = *set.remotes[set.remotes.size() - 1];
+    return r.base + r.n_docs;
+}
+
+// A sharded index (boolindex --shards) lists independent indexes in shards.tsv;
+// each one is opened like a top-level index and its segments follow the previous shard's.
+static int open_index_set(const fs::path& root, IndexSet& set) {
+    std::ifstream shards(root / "shards.tsv", std::ios::binary);
+    std::string line;
+    if (shards) {
+        Vector<std::string> names;
+        while (std::getline(shards, line)) {
+            size_t p1 = line.find('\t');
+            if (p1 != std::string::npos && p1 > 0) names.push_back(line.substr(0, p1));
+        }
+        for (size_t i = 0; i < names.size(); ++i) {
+            int rc = open_index_set(root / names[i], set);
+            if (rc != 0) return rc;
+        }
+        return 0;
+    }
+
+    Vector<std::string> names;
+    names.push_back("");
+    std::ifstream manifest(root / "segments.tsv", std::ios::binary);
+    while (std::getline(manifest, line)) {
+        size_t p1 = line.find('\t');
+        if (p1 != std::string::npos && p1 > 0) names.push_back(line.substr(0, p1));
+    }
+
+    for (size_t i = 0; i < names.size(); ++i) {
+        std::unique_ptr<Index> idx(new Index());
+        int rc = open_index(names[i].empty() ? root : root / names[i], *idx);
+        if (rc != 0) return rc;
+        if (set.segs.empty()) set.stem = idx->stem;
+        else if (idx->stem != set.stem) { std::cerr << "Segments use different stemmers\n"; return 2; }
+        set.bases.push_back(set.n_docs);
+        set.n_docs += idx->docs.size();
+        set.segs.push_back(std::move(idx));
+    }
+    return 0;
+}
+
+static bool add_remote(IndexSet& set, const std::string& spec) {
+    std::unique_ptr<RemoteShard> r(new RemoteShard());
+    r->spec = spec;
+    r->base = total_docs(set);
+    std::string head;
+    Vector<std::string> lines;
+    if (!remote_call(*r, "!info\n", head, lines) || head.compare(0, 3, "OK ") != 0) return false;
+    r->n_docs = (uint32_t)std::strtoul(head.c_str() + 3, nullptr, 10);
+    size_t sp = head.find(' ', 3);
+    sp = (sp == std::string::npos) ? sp : head.find(' ', sp + 1);
+    if (sp != std::string::npos) r->mode = head.substr(sp + 1);
+    set.remotes.push_back(std::move(r));
+    return true;
+}
+
+static std::string doc_path(const IndexSet& set, uint32_t id) {
+    size_t s = set.segs.size();
+    while (s > 0 && set.bases[s - 1] > id) --s;
+    if (s == 0) return std::string();
+    return set.segs[s - 1]->docs.path(id - set.bases[s - 1]);
+}
+
+// What one segment or remote shard contributes to a query; ids are global.
+struct ShardHits {
+    bool ok = true;
+    size_t hits = 0;
+    Vector<uint32_t> ids;
+    Vector<double> scores;
+    Vector<std::string> paths;
+};
+
+// Response lines of a remote shard are "<id>\t<path>" with an optional "\t<score>".
+static void remote_search(RemoteShard& r, const std::string& query, size_t k, ShardHits& out) {
+    std::lock_guard<std::mutex> lock(r.mu);
+    std::string head;
+    Vector<std::string> lines;
+    if (!remote_call(r, std::to_string(k) + "\t" + query + "\n", head, lines)) {
+        std::cerr << "shard " << r.spec << " is unavailable\n";
+        return;
+    }
+    if (head.compare(0, 3, "OK ") != 0) { out.ok = false; return; }
+    out.hits = (size_t)std::strtoull(head.c_str() + 3, nullptr, 10);
+    for (size_t i = 0; i < lines.size(); ++i) {
+        const std::string& line = lines[i];
+        size_t t1 = line.find('\t');
+        if (t1 == std::string::npos) continue;
+        size_t t2 = line.find('\t', t1 + 1);
+        out.ids.push_back(r.base + (uint32_t)std::strtoul(line.c_str(), nullptr, 10));
+        out.paths.push_back(line.substr(t1 + 1, t2 == std::string::npos ? std::string::npos : t2 - t1 - 1));
+        out.scores.push_back(t2 == std::string::npos ? 0.0 : std::strtod(line.c_str() + t2 + 1, nullptr));
+    }
+}
+
+// Each segment and remote shard yields its own first `topk` matches (with
+// `estimate`, document-at-a-time, see eval_first); the coordinator keeps the
+// first `topk` in docID order and sums the hit counts.
+static bool search(const IndexSet& set, const std::string& query, size_t topk, size_t& hits, Vector<uint32_t>& ids,
+                   Vector<std::string>& paths, bool estimate = false, QueryCache* cache = nullptr) {
+    Vector<QToken> qt, rpn;
+    query_tokenize(query, set.stem, qt);
+    to_rpn(qt, rpn);
+
+    size_t n_local = set.segs.size();
+    Vector<ShardHits> parts;
+    parts.resize(n_local + set.remotes.size());
+    scatter(parts.size(), set.fanout, [&](size_t s) {
+        ShardHits& part = parts[s];
+        if (s >= n_local) { remote_search(*set.remotes[s - n_local], query, topk, part); return; }
+        const Index& idx = *set.segs[s];
+        Vector<uint32_t> first;
+        if (estimate) {
+            part.ok = eval_first(idx, rpn, topk, first, part.hits);
+        } else {
+            DocSet res;
+            part.ok = eval_rpn(idx, rpn, res, cache);
+            part.hits = res.size();
+            if (part.ok) docset_first(res, topk, first);
+        }
+        for (size_t i = 0; i < first.size(); ++i) part.ids.push_back(set.bases[s] + first[i]);
+    });
+
+    hits = 0;
+    for (size_t s = 0; s < parts.size(); ++s) {
+        if (!parts[s].ok) return false;
+        hits += parts[s].hits;
+        for (size_t i = 0; i < parts[s].ids.size() && ids.size() < topk; ++i) {
+            ids.push_back(parts[s].ids[i]);
+            paths.push_back(s < n_local ? doc_path(set, parts[s].ids[i]) : parts[s].paths[i]);
+        }
+    }
+    return true;
+}
+
+static const double BM25_K1 = 1.2;
+static const double BM25_B = 0.75;
+
+static double bm25_tf(uint32_t tf, uint32_t len, double avgdl) {
+    double norm = BM25_K1 * (1.0 - BM25_B + BM25_B * (double)len / avgdl);
+    return (double)tf * (BM25_K1 + 1.0) / ((double)tf + norm);
+}
+
+// One query term inside one segment: a term cursor plus the term's tf.bin
+// record. List terms bound each skip block by its (max tf, min length);
+// bitmap terms have no blocks, so their only bound is the term-wide one.
+struct RankCursor {
+    TermCursor tc;
+    const char* blocks = nullptr;
+    const uint8_t* tf = nullptr;
+    uint32_t n_blocks = 0;
+    uint32_t qi = 0;
+    double w = 0;
+    double ub = 0;
+
+    uint32_t doc() const { return tc.doc(); }
+
+    TfBlockMax block(uint32_t b) const {
+        TfBlockMax m;
+        std::memcpy(&m, blocks + sizeof(TfBlockMax) * (size_t)b, sizeof(m));
+        return m;
+    }
+
+    double score(uint32_t len, double avgdl) { return w * bm25_tf(tf[tc.rank()], len, avgdl); }
+
+    // Upper bound for any doc in the block holding d; `last` is that block's last docID.
+    double block_bound(uint32_t d, uint32_t& last, double avgdl) const {
+        const TermIter* list = tc.list;
+        if (!list || list->c.n_blocks == 0) { last = UINT32_MAX; return ub; }
+        uint32_t b = list->c.block_of(d);
+        last = list->c.block_last(b);
+        TfBlockMax m = block(b);
+        return w * bm25_tf(m.max_tf, m.min_len, avgdl);
+    }
+};
+
+struct Ranked {
+    double score;
+    uint32_t doc;
+};
+
+// Heap order: the front is the weakest entry; equal scores prefer lower docIDs.
+static bool ranked_better(const Ranked& a, const Ranked& b) {
+    return a.score > b.score || (a.score == b.score && a.doc < b.doc);
+}
+
+static void offer(Vector<Ranked>& heap, size_t k, const Ranked& r) {
+    if (heap.size() < k) {
+        heap.push_back(r);
+        std::push_heap(heap.data(), heap.data() + heap.size(), ranked_better);
+    } else if (ranked_better(r, heap[0])) {
+        std::pop_heap(heap.data(), heap.data() + heap.size(), ranked_better);
+        heap[heap.size() - 1] = r;
+        std::push_heap(heap.data(), heap.data() + heap.size(), ranked_better);
+    }
+}
+
+// Ties on doc keep query-term order, so a document's score is always summed the same way.
+static bool cursor_less(const RankCursor* a, const RankCursor* b) {
+    return a->doc() < b->doc() || (a->doc() == b->doc() && a->qi < b->qi);
+}
+
+static void sort_by_doc(Vector<RankCursor*>& v) {
+    for (size_t i = 1; i < v.size(); ++i) {
+        RankCursor* x = v[i];
+        size_t j = i;
+        while (j > 0 && cursor_less(x, v[j - 1])) { v[j] = v[j - 1]; --j; }
+        v[j] = x;
+    }
+}
+
+static void drop_done(Vector<RankCursor*>& v, Vector<bool>& done) {
+    size_t o = 0;
+    for (size_t i = 0; i < v.size(); ++i) {
+        if (!done[i]) v[o++] = v[i];
+    }
+    v.resize(o);
+}
+
+// Block-max WAND over one segment. The pivot is the first cursor at which the
+// summed term bounds exceed the heap threshold; if the block bounds at the pivot
+// doc still cannot beat it, every pivot cursor jumps past the shortest of those
+// blocks without scoring anything in between.
+static void wand_segment(const Index& idx, Vector<RankCursor*> live, double avgdl, uint32_t base, size_t k,
+                         Vector<Ranked>& heap, size_t& scored) {
+    Vector<bool> done;
+    sort_by_doc(live);
+    while (!live.empty()) {
+        double theta = (heap.size() < k) ? -1.0 : heap[0].score;
+        double acc = 0;
+        size_t p = 0;
+        for (; p < live.size(); ++p) {
+            acc += live[p]->ub;
+            if (acc > theta) break;
+        }
+        if (p == live.size()) break;
+        uint32_t pd = live[p]->doc();
+        while (p + 1 < live.size() && live[p + 1]->doc() == pd) ++p;
+
+        done.clear();
+        done.resize(live.size());
+        uint64_t next_doc = (p + 1 < live.size()) ? live[p + 1]->doc() : (uint64_t)UINT32_MAX;
+        double bsum = 0;
+        for (size_t t = 0; t <= p; ++t) {
+            uint32_t last;
+            bsum += live[t]->block_bound(pd, last, avgdl);
+            if ((uint64_t)last + 1 < next_doc) next_doc = (uint64_t)last + 1;
+        }
+        if (bsum <= theta) {
+            for (size_t t = 0; t <= p; ++t) done[t] = !live[t]->tc.advance((uint32_t)next_doc);
+        } else if (live[0]->doc() == pd) {
+            uint32_t len = idx.lens.get(pd);
+            double sc = 0;
+            for (size_t t = 0; t <= p; ++t) sc += live[t]->score(len, avgdl);
+            ++scored;
+            offer(heap, k, {sc, base + pd});
+            for (size_t t = 0; t <= p; ++t) done[t] = !live[t]->tc.next();
+        } else {
+            for (size_t t = 0; t < p && live[t]->doc() < pd; ++t) done[t] = !live[t]->tc.advance(pd);
+        }
+        drop_done(live, done);
+        sort_by_doc(live);
+    }
+}
+
+// Why search() rejected a query, for the error reply.
+static const char* query_error(const std::string& query, ir::StemMode stem) {
+    Vector<QToken> qt, rpn;
+    query_tokenize(query, stem, qt);
+    to_rpn(qt, rpn);
+    Vector<bool> word;
+    for (size_t i = 0; i < rpn.size(); ++i) {
+        TokenType t = rpn[i].type;
+        if (!is_op(t)) { word.push_back(t == TT_TERM); continue; }
+        if (t == TT_NOT) {
+            if (word.empty()) break;
+            word[word.size() - 1] = false;
+            continue;
+        }
+        if (word.size() < 2) break;
+        bool b = word[word.size() - 1]; word.pop_back();
+        bool a = word[word.size() - 1]; word.pop_back();
+        if (t == TT_NEAR && !(a && b)) return "NEAR takes a single word on each side";
+        word.push_back(false);
+    }
+    return "Bad query";
+}
+
+// Ranked mode: the query is taken as a bag of terms (operators and prefixes are
+// ignored, phrase words count as terms, repeated terms weigh more) and scored with BM25 using collection-wide
+// N, df and average length, so scores are comparable across segments. With
+// fanout > 1 every local segment fills its own heap and the heaps are merged;
+// remote shards score with their own statistics.
+static void rank_search(const IndexSet& set, const std::string& query, size_t topk, size_t& scored,
+                        Vector<uint32_t>& ids, Vector<double>& scores, Vector<std::string>& paths) {
+    Vector<QToken> qt;
+    query_tokenize(query, set.stem, qt);
+    Vector<std::string> terms;
+    Vector<double> qw;
+    for (size_t i = 0; i < qt.size(); ++i) {
+        if (qt[i].type != TT_TERM && qt[i].type != TT_PHRASE) continue;
+        Vector<std::string> words;
+        split_words(qt[i].text, words);
+        for (size_t k = 0; k < words.size(); ++k) {
+            size_t j = 0;
+            while (j < terms.size() && terms[j] != words[k]) ++j;
+            if (j == terms.size()) { terms.push_back(words[k]); qw.push_back(0); }
+            qw[j] += 1;
+        }
+    }
+
+    uint64_t total_len = 0;
+    for (size_t s = 0; s < set.segs.size(); ++s) total_len += set.segs[s]->lens.total;
+    double n_docs = (double)set.n_docs;
+    double avgdl = (set.n_docs && total_len) ? (double)total_len / n_docs : 1.0;
+
+    Vector<TermInfo> tis;
+    Vector<bool> found;
+    tis.resize(terms.size() * set.segs.size());
+    found.resize(tis.size());
+    Vector<double> idf;
+    for (size_t t = 0; t < terms.size(); ++t) {
+        uint64_t df = 0;
+        for (size_t s = 0; s < set.segs.size(); ++s) {
+            size_t at = s * terms.size() + t;
+            found[at] = set.segs[s]->dict.find(terms[t], tis[at]);
+            if (found[at]) df += tis[at].df;
+        }
+        idf.push_back(std::log(1.0 + (n_docs - (double)df + 0.5) / ((double)df + 0.5)));
+    }
+
+    size_t n_local = set.segs.size();
+    bool shared = set.fanout <= 1;
+    Vector<ShardHits> parts;
+    parts.resize(n_local + set.remotes.size());
+    Vector< Vector<Ranked> > heaps;
+    heaps.resize(shared ? 1 : n_local);
+    auto rank_segment = [&](size_t s) {
+        if (s >= n_local) { remote_search(*set.remotes[s - n_local], query, topk, parts[s]); return; }
+        ScopedTimer timer(S_RANK);
+        const Index& idx = *set.segs[s];
+        Vector<std::unique_ptr<RankCursor> > cursors;
+        Vector<RankCursor*> live;
+        for (size_t t = 0; t < terms.size(); ++t) {
+            size_t at = s * terms.size() + t;
+            const char* rec = found[at] ? idx.tf.record(tis[at]) : nullptr;
+            if (!rec || tis[at].df == 0) continue;
+            std::unique_ptr<RankCursor> c(new RankCursor());
+            if (!c->tc.open(idx, tis[at])) continue;
+            c->n_blocks = (tis[at].df + SKIP_BLOCK - 1) / SKIP_BLOCK;
+            c->blocks = rec;
+            c->tf = (const uint8_t*)rec + sizeof(TfBlockMax) * (size_t)c->n_blocks;
+            c->qi = (uint32_t)t;
+            c->w = idf[t] * qw[t];
+            for (uint32_t b = 0; b < c->n_blocks; ++b) {
+                TfBlockMax m = c->block(b);
+                double x = c->w * bm25_tf(m.max_tf, m.min_len, avgdl);
+                if (x > c->ub) c->ub = x;
+            }
+            if (!c->tc.next()) continue;
+            live.push_back(c.get());
+            cursors.push_back(std::move(c));
+        }
+        wand_segment(idx, live, avgdl, set.bases[s], topk, heaps[shared ? 0 : s], parts[s].hits);
+    };
+    if (topk) scatter(parts.size(), set.fanout, rank_segment);
+
+    scored = 0;
+    Vector<Ranked> heap;
+    for (size_t h = 0; h < heaps.size(); ++h) {
+        for (size_t i = 0; i < heaps[h].size(); ++i) offer(heap, topk, heaps[h][i]);
+    }
+    for (size_t s = 0; s < parts.size(); ++s) {
+        scored += parts[s].hits;
+        if (s < n_local) S_SCORED.add(parts[s].hits);
+        for (size_t i = 0; i < parts[s].ids.size(); ++i) offer(heap, topk, {parts[s].scores[i], parts[s].ids[i]});
+    }
+
+    std::sort(heap.data(), heap.data() + heap.size(), ranked_better);
+    for (size_t i = 0; i < heap.size(); ++i) {
+        uint32_t doc = heap[i].doc;
+        ids.push_back(doc);
+        scores.push_back(heap[i].score);
+        if (doc < set.n_docs) { paths.push_back(doc_path(set, doc)); continue; }
+        std::string path;
+        for (size_t s = n_local; s < parts.size() && path.empty(); ++s) {
+            for (size_t j = 0; j < parts[s].ids.size(); ++j) {
+                if (parts[s].ids[j] == doc) { path = parts[s].paths[j]; break; }
+            }
+        }
+        paths.push_back(path);
+    }
+}
+
+enum SearchMode { MODE_EXACT, MODE_ESTIMATE, MODE_BM25 };
+
+static const char* mode_name(SearchMode m) {
+    return m == MODE_BM25 ? "bm25" : (m == MODE_ESTIMATE ? "estimate" : "exact");
+}
+
+static std::string format_score(double x) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.4f", x);
+    return buf;
+}
+
+// How a service opens (and on "!reload" reopens) what it searches.
+struct Collection {
+    std::string index_dir;
+    bool local = true;
+    Vector<std::string> remotes;
+    int fanout = 0;
+    int decode_threads = 1;
+    SearchMode mode = MODE_EXACT;
+};
+
+static int open_collection(const Collection& c, IndexSet& set) {
+    if (c.local) {
+        int rc = open_index_set(c.index_dir, set);
+        if (rc != 0) return rc;
+    }
+    for (size_t i = 0; i < c.remotes.size(); ++i) {
+        if (!add_remote(set, c.remotes[i])) { std::cerr << "Cannot reach shard " << c.remotes[i] << "\n"; return 2; }
+        // Requests carry no mode, so a shard answers in the one it was started with.
+        const std::string& remote_mode = set.remotes[set.remotes.size() - 1]->mode;
+        if (remote_mode != mode_name(c.mode)) {
+            std::cerr << "Shard " << c.remotes[i] << " runs in mode " << (remote_mode.empty() ? "unknown" : remote_mode)
+                      << ", not " << mode_name(c.mode) << "; start it with the same --count/--rank\n";
+            return 2;
+        }
+    }
+    // Sharded and remote collections fan out to every shard by default.
+    set.fanout = c.fanout;
+    if (set.fanout <= 0) {
+        bool sharded = c.local && fs::exists(fs::path(c.index_dir) / "shards.tsv");
+        set.fanout = (sharded || !c.remotes.empty()) ? (int)(set.segs.size() + set.remotes.size()) : 1;
+    }
+    set.generation = 0;
+    for (size_t s = 0; s < set.segs.size(); ++s) {
+        set.segs[s]->decode_threads = c.decode_threads;
+        set.generation = (set.generation ^ set.segs[s]->generation) * 1099511628211ULL;
+    }
+    if (c.mode == MODE_BM25) {
+        for (size_t s = 0; s < set.segs.size(); ++s) {
+            if (!set.segs[s]->tf.is_open() || !set.segs[s]->lens.lens) {
+                std::cerr << "Index has no tf.bin/doclen.bin; rebuild it with boolindex for --rank bm25\n";
+                return 2;
+            }
+        }
+    }
+    return 0;
+}
+
+// A long-lived searcher. The index set sits behind a shared_ptr: "!reload"
+// swaps in a freshly opened one while requests in flight finish on the old.
+struct Service {
+    Collection coll;
+    int default_topk = 10;
+    std::shared_ptr<const IndexSet> set;
+    std::unique_ptr<QueryCache> cache;
+    std::mutex reload_mu;
+
+    std::shared_ptr<const IndexSet> current() const { return std::atomic_load(&set); }
+};
+
+// The normalized query for the response cache: its RPN over stemmed words,
+// so spellings that parse the same way share an entry.
+static std::string rpn_key(const Vector<QToken>& rpn) {
+    std::string k;
+    for (size_t i = 0; i < rpn.size(); ++i) {
+        const QToken& t = rpn[i];
+        if (i) k += ' ';
+        if (t.type == TT_TERM) k += t.text;
+        else if (t.type == TT_PREFIX) { k += t.text; k += '*'; }
+        else if (t.type == TT_PHRASE) { k += '"'; k += t.text; k += '"'; }
+        else if (t.type == TT_AND) k += "AND";
+        else if (t.type == TT_OR) k += "OR";
+        else if (t.type == TT_NOT) k += "NOT";
+        else if (t.type == TT_NEAR) { k += "NEAR/"; k += t.text; }
+    }
+    return k;
+}
+
+// Reopens the collection. Cached postings of segments that are still there
+// survive (their generation did not change); cached responses belong to one
+// set generation and go whenever it changes.
+static std::string reload(Service& svc) {
+    std::lock_guard<std::mutex> lock(svc.reload_mu);
+    std::shared_ptr<IndexSet> fresh(new IndexSet());
+    if (open_collection(svc.coll, *fresh) != 0) return "ERR Reload failed\n";
+    std::atomic_store(&svc.set, std::shared_ptr<const IndexSet>(fresh));
+    if (svc.cache) {
+        mystl::HashMap<int> live(fresh->segs.size() + 1);
+        for (size_t s = 0; s < fresh->segs.size(); ++s) live.get_or_insert(std::to_string(fresh->segs[s]->generation), 1);
+        std::string prefix = std::to_string(fresh->generation) + '|';
+        svc.cache->postings.erase_if([&](const std::string& k) { return !live.find(k.substr(0, k.find('|'))); });
+        svc.cache->results.erase_if([&](const std::string& k) { return k.compare(0, prefix.size(), prefix) != 0; });
+    }
+    return "OK " + std::to_string(total_docs(*fresh)) + " 0\n";
+}
+
+static std::string cache_stats(const QueryCache* c) {
+    if (!c) return "OK 0 0\n";
+    std::string body;
+    auto line = [&](const char* name, size_t v) { body += name; body += '\t'; body += std::to_string(v); body += '\n'; };
+    line("result_hits", c->results.hits());
+    line("result_misses", c->results.misses());
+    line("result_entries", c->results.entries());
+    line("result_bytes", c->results.bytes());
+    line("postings_hits", c->postings.hits());
+    line("postings_misses", c->postings.misses());
+    line("postings_entries", c->postings.entries());
+    line("postings_bytes", c->postings.bytes());
+    return "OK 0 8\n" + body;
+}
+
+// The cache gauges are copies of the cache's own counters, taken right before
+// the stats are rendered.
+static void sync_cache_stats(const QueryCache* c) {
+    if (!c) return;
+    S_RESULT_HITS.set(c->results.hits());
+    S_RESULT_MISSES.set(c->results.misses());
+    S_RESULT_ENTRIES.set(c->results.entries());
+    S_RESULT_BYTES.set(c->results.bytes());
+    S_PCACHE_HITS.set(c->postings.hits());
+    S_PCACHE_MISSES.set(c->postings.misses());
+    S_PCACHE_ENTRIES.set(c->postings.entries());
+    S_PCACHE_BYTES.set(c->postings.bytes());
+}
+
+static std::string metrics_text(const Service& svc) {
+    sync_cache_stats(svc.cache.get());
+    return stats_prometheus("boolsearch");
+}
+
+// "!metrics" wraps the exposition text in the usual "OK 0 <n>" framing.
+static std::string metrics_reply(const Service& svc) {
+    std::string text = metrics_text(svc);
+    size_t n = (size_t)std::count(text.begin(), text.end(), '\n');
+    return "OK 0 " + std::to_string(n) + "\n" + text;
+}
+
+// A request line "GET <path> HTTP/1.x" on the same socket is answered as HTTP,
+// so a Prometheus scraper can read /metrics directly.
+static std::string http_reply(const Service& svc, const std::string& request) {
+    size_t sp = request.find(' ', 4);
+    std::string path = request.substr(4, sp == std::string::npos ? std::string::npos : sp - 4);
+    if (path != "/metrics") return "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    std::string body = metrics_text(svc);
+    return "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + std::to_string(body.size()) +
+           "\r\nConnection: close\r\n\r\n" + body;
+}
+
+// Request: "<query>\n" or "<topk>\t<query>\n".
+// Response: "OK <hits> <n>\n" followed by n lines "<id>\t<path>\n", or "ERR <message>\n".
+// In BM25 mode <hits> is the number of fully scored documents and each line ends in "\t<score>".
+// Control requests: "!info" answers "OK <n_docs> 0 <mode>" (how a coordinator sizes
+// and checks its remote shards), "!reload" reopens the index, "!cache" lists the cache counters,
+// "!metrics" returns every counter in the Prometheus text format.
+static std::string serve_one(Service& svc, const std::string& line) {
+    if (line == "!reload") return reload(svc);
+    if (line == "!cache") return cache_stats(svc.cache.get());
+    if (line == "!metrics") return metrics_reply(svc);
+    ScopedTimer timer(S_QUERY);
+    S_QUERIES.add(1);
+    std::shared_ptr<const IndexSet> snapshot = svc.current();
+    const IndexSet& idx = *snapshot;
+    if (line == "!info") return "OK " + std::to_string(total_docs(idx)) + " 0 " + mode_name(svc.coll.mode) + "\n";
+
+    std::string query = line;
+    int topk = svc.default_topk;
+    size_t tab = line.find('\t');
+    if (tab != std::string::npos && tab > 0 && tab < 10 &&
+        line.find_first_not_of("0123456789") == tab) {
+        topk = std::stoi(line.substr(0, tab));
+        query = line.substr(tab + 1);
+    }
+    SearchMode mode = svc.coll.mode;
+    QueryCache* cache = svc.cache.get();
+
+    // Remote shards change behind our back, so their answers are not kept.
+    std::string key;
+    if (cache && idx.remotes.empty()) {
+        Vector<QToken> qt, rpn;
+        query_tokenize(query, idx.stem, qt);
+        to_rpn(qt, rpn);
+        key = std::to_string(idx.generation) + '|' + (char)('0' + mode) + '|' + std::to_string(topk) + '|' + rpn_key(rpn);
+        std::string hit;
+        if (cache->results.get(key, hit)) return hit;
+    }
+
+    size_t hits = 0;
+    Vector<uint32_t> first;
+    Vector<double> scores;
+    Vector<std::string> paths;
+    size_t k = topk > 0 ? (size_t)topk : 0;
+    std::string resp;
+    if (mode == MODE_BM25) {
+        rank_search(idx, query, k, hits, first, scores, paths);
+    } else if (!search(idx, query, k, hits, first, paths, mode == MODE_ESTIMATE, cache)) {
+        resp = std::string("ERR ") + query_error(query, idx.stem) + "\n";
+        S_QUERY_ERRORS.add(1);
+    }
+    if (resp.empty()) {
+        std::string body;
+        for (size_t i = 0; i < first.size(); ++i) {
+            body += std::to_string(first[i]);
+            body += '\t';
+            body += paths[i];
+            if (mode == MODE_BM25) { body += '\t'; body += format_score(scores[i]); }
+            body += '\n';
+        }
+        resp = "OK " + std::to_string(hits) + " " + std::to_string(first.size()) + "\n" + body;
+    }
+    if (!key.empty()) cache->results.put(key, resp, resp.size());
+    return resp;
+}
+
+static void serve_stream(Service& svc, int in_fd, int out_fd) {
+    std::string buf;
+    std::string http;
+    char chunk[4096];
+    for (;;) {
+        size_t nl;
+        while ((nl = buf.find('\n')) != std::string::npos) {
+            std::string line = buf.substr(0, nl);
+            buf.erase(0, nl + 1);
+            if (!line.empty() && line[line.size()-1] == '\r') line.pop_back();
+            // HTTP headers are skipped; the blank line ending them triggers the reply.
+            if (!http.empty()) {
+                if (line.empty()) { write_all(out_fd, http_reply(svc, http)); return; }
+                continue;
+            }
+            if (line.empty()) continue;
+            if (line.compare(0, 4, "GET ") == 0) { http = line; continue; }
+            if (!write_all(out_fd, serve_one(svc, line))) return;
+        }
+        ssize_t r = ::read(in_fd, chunk, sizeof(chunk));
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        buf.append(chunk, (size_t)r);
+    }
+    if (!http.empty()) write_all(out_fd, http_reply(svc, http));
+    else if (!buf.empty()) write_all(out_fd, serve_one(svc, buf));
+}
+
+static int listen_socket(const std::string& unix_path, const std::string& host, int port) {
+    int fd = -1;
+    if (!unix_path.empty()) {
+        fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (unix_path.size() >= sizeof(addr.sun_path)) { ::close(fd); return -1; }
+        std::memcpy(addr.sun_path, unix_path.c_str(), unix_path.size() + 1);
+        ::unlink(unix_path.c_str());
+        if (::bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0) { ::close(fd); return -1; }
+    } else {
+        fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        int one = 1;
+        ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t)port);
+        if (::inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) { ::close(fd); return -1; }
+        if (::bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0) { ::close(fd); return -1; }
+    }
+    if (::listen(fd, 64) != 0) { ::close(fd); return -1; }
+    return fd;
+}
+
+// Each connection gets its own thread; they share the index set and the cache.
+static int serve(Service& svc, const std::string& unix_path, const std::string& host, int port) {
+    if (unix_path.empty() && port <= 0) {
+        serve_stream(svc, 0, 1);
+        return 0;
+    }
+    std::signal(SIGPIPE, SIG_IGN);
+    int lfd = listen_socket(unix_path, host, port);
+    if (lfd < 0) { std::cerr << "Cannot listen: " << std::strerror(errno) << "\n"; return 4; }
+    std::cerr << "serving on " << (unix_path.empty() ? host + ":" + std::to_string(port) : unix_path) << "\n";
+    for (;;) {
+        int cfd = ::accept(lfd, nullptr, nullptr);
+        if (cfd < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        std::thread([&svc, cfd]() {
+            serve_stream(svc, cfd, cfd);
+            ::close(cfd);
+        }).detach();
+    }
+    ::close(lfd);
+    return 0;
+}
+
+// Replays a query log: each line is answered as in --serve (responses go to
+// stdout in input order) and a latency summary goes to stderr.
+static int run_batch(Service& svc, const std::string& path, int threads) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) { std::cerr << "Cannot open " << path << "\n"; return 2; }
+    Vector<std::string> lines;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line[line.size() - 1] == '\r') line.pop_back();
+        lines.push_back(line);
+    }
+
+    Vector<std::string> out;
+    Vector<double> lat;
+    out.resize(lines.size());
+    lat.resize(lines.size());
+
+    auto t0 = std::chrono::steady_clock::now();
+    std::atomic<size_t> next(0);
+    auto work = [&]() {
+        for (size_t i; (i = next++) < lines.size();) {
+            auto q0 = std::chrono::steady_clock::now();
+            out[i] = serve_one(svc, lines[i]);
+            lat[i] = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - q0).count();
+        }
+    };
+    if (threads > 1) {
+        Vector<std::thread> workers;
+        for (int w = 0; w < threads; ++w) workers.emplace_back(work);
+        for (size_t w = 0; w < workers.size(); ++w) workers[w].join();
+    } else {
+        work();
+    }
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    for (size_t i = 0; i < out.size(); ++i) std::cout << out[i];
+    std::cout.flush();
+
+    std::sort(lat.data(), lat.data() + lat.size());
+    auto pct = [&](double p) { return lat.empty() ? 0.0 : lat[(size_t)(p * (double)(lat.size() - 1))]; };
+    std::cerr << "queries: " << lines.size() << "\n";
+    std::cerr << "wall_s: " << wall << "\n";
+    std::cerr << "qps: " << (wall > 0 ? (double)lines.size() / wall : 0.0) << "\n";
+    std::cerr << "latency_us p50: " << pct(0.50) << " p90: " << pct(0.90) << " p99: " << pct(0.99)
+              << " max: " << pct(1.0) << "\n";
+    if (svc.cache) {
+        std::cerr << "result cache hits: " << svc.cache->results.hits() << " misses: " << svc.cache->results.misses() << "\n";
+        std::cerr << "postings cache hits: " << svc.cache->postings.hits() << " misses: " << svc.cache->postings.misses() << "\n";
+    }
+    return 0;
+}
+
+// --query: one answer on stdout in the plain, non-protocol format.
+static int run_query(const IndexSet& idx, const std::string& query, size_t k, SearchMode mode) {
+    ScopedTimer timer(S_QUERY);
+    S_QUERIES.add(1);
+    if (mode == MODE_BM25) {
+        size_t scored = 0;
+        Vector<uint32_t> ids;
+        Vector<double> scores;
+        Vector<std::string> paths;
+        rank_search(idx, query, k, scored, ids, scores, paths);
+        std::cout << "scored: " << scored << "\n";
+        for (size_t i = 0; i < ids.size(); ++i) {
+            std::cout << ids[i] << "\t" << paths[i] << "\t" << format_score(scores[i]) << "\n";
+        }
+        return 0;
+    }
+
+    size_t hits = 0;
+    Vector<uint32_t> first;
+    Vector<std::string> paths;
+    if (!search(idx, query, k, hits, first, paths, mode == MODE_ESTIMATE)) {
+        std::cerr << query_error(query, idx.stem) << "\n";
+        S_QUERY_ERRORS.add(1);
+        return 3;
+    }
+
+    std::cout << "hits: " << hits << "\n";
+    for (size_t i = 0; i < first.size(); ++i) std::cout << first[i] << "\t" << paths[i] << "\n";
+    return 0;
+}
+
+static void usage() {
+    std::cout << "Usage: boolsearch --index_dir out_bool/index --query \"A AND (B OR C)\" [--topk 10] [--count exact|estimate] [--rank bm25]\n";
+    std::cout << "       boolsearch --index_dir out_bool/index --serve [--socket path | --port N [--host 127.0.0.1]] [--cache_mb 64] [--topk 10] [--count exact|estimate] [--rank bm25]\n";
+    std::cout << "       boolsearch --index_dir out_bool/index --queries file [--threads N] [--cache_mb 64] [--topk 10] [--count exact|estimate] [--rank bm25]\n";
+    std::cout << "       any mode: [--remote unix:/path|host:port]... [--fanout N] [--decode_threads N]\n";
+    std::cout << "       --query and --queries: [--stats file|-] writes the counters as JSON on exit\n";
+}
+
+static int write_stats(const std::string& path, const Service& svc, int rc) {
+    if (path.empty()) return rc;
+    sync_cache_stats(svc.cache.get());
+    std::string json = stats_json("boolsearch");
+    if (path == "-") { std::cerr << json; return rc; }
+    std::ofstream out(path, std::ios::binary);
+    out << json;
+    if (!out) { std::cerr << "Cannot write " << path << "\n"; return rc ? rc : 2; }
+    return rc;
+}
+
+int main(int argc, char** argv) {
+    std::string index_dir = "out_bool/index";
+    std::string query;
+    int topk = 10;
+    bool serve_mode = false;
+    std::string unix_path;
+    std::string host = "127.0.0.1";
+    int port = 0;
+    bool estimate = false;
+    bool ranked = false;
+    std::string queries_path;
+    int threads = 1;
+    size_t cache_mb = 64;
+    bool local = false;
+    Vector<std::string> remotes;
+    int fanout = 0;
+    int decode_threads = 1;
+    std::string stats_path;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--index_dir" && i + 1 < argc) { index_dir = argv[++i]; local = true; }
+        else if (a == "--query" && i + 1 < argc) query = argv[++i];
+        else if (a == "--topk" && i + 1 < argc) topk = std::stoi(argv[++i]);
+        else if (a == "--serve") serve_mode = true;
+        else if (a == "--socket" && i + 1 < argc) unix_path = argv[++i];
+        else if (a == "--host" && i + 1 < argc) host = argv[++i];
+        else if (a == "--port" && i + 1 < argc) port = std::stoi(argv[++i]);
+        else if (a == "--count" && i + 1 < argc) estimate = std::string(argv[++i]) == "estimate";
+        else if (a == "--rank" && i + 1 < argc) {
+            if (std::string(argv[++i]) != "bm25") { usage(); return 1; }
+            ranked = true;
+        }
+        else if (a == "--queries" && i + 1 < argc) queries_path = argv[++i];
+        else if (a == "--threads" && i + 1 < argc) threads = std::stoi(argv[++i]);
+        else if (a == "--cache_mb" && i + 1 < argc) cache_mb = (size_t)std::stoull(argv[++i]);
+        else if (a == "--remote" && i + 1 < argc) remotes.push_back(argv[++i]);
+        else if (a == "--fanout" && i + 1 < argc) fanout = std::stoi(argv[++i]);
+        else if (a == "--decode_threads" && i + 1 < argc) decode_threads = std::stoi(argv[++i]);
+        else if (a == "--stats" && i + 1 < argc) stats_path = argv[++i];
+        else if (a == "-h" || a == "--help") { usage(); return 0; }
+    }
+    if (query.empty() && !serve_mode && queries_path.empty()) { usage(); return 1; }
+
+    Service svc;
+    svc.coll.index_dir = index_dir;
+    svc.coll.local = local || remotes.empty();
+    svc.coll.remotes = remotes;
+    svc.coll.fanout = fanout;
+    svc.coll.decode_threads = decode_threads;
+    svc.coll.mode = ranked ? MODE_BM25 : (estimate ? MODE_ESTIMATE : MODE_EXACT);
+    svc.default_topk = topk;
+    if (!remotes.empty()) std::signal(SIGPIPE, SIG_IGN);
+    std::shared_ptr<IndexSet> opened(new IndexSet());
+    int rc = open_collection(svc.coll, *opened);
+    if (rc != 0) return rc;
+    svc.set = opened;
+    const IndexSet& idx = *opened;
+
+    if (cache_mb && (serve_mode || !queries_path.empty())) svc.cache.reset(new QueryCache(cache_mb * 1024 * 1024));
+    if (serve_mode) return serve(svc, unix_path, host, port);
+    if (!queries_path.empty()) return write_stats(stats_path, svc, run_batch(svc, queries_path, threads));
+
+    return write_stats(stats_path, svc, run_query(idx, query, topk > 0 ? (size_t)topk : 0, svc.coll.mode));
 }
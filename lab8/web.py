@@ -1,5 +1,7 @@
 import os
 import re
+import socket
+import struct
 import argparse
 from html import escape
 from flask import Flask, request
@@ -65,15 +67,67 @@ def load_dict(dict_tsv):
                 d[term] = (off, df)
     return d
 
-def load_postings(bin_path, off, df):
+POSTINGS_MAGIC = b"IRPOST"
+SKIP_BLOCK = 128
+CODEC_VARINT = 0
+CODEC_BP128 = 1
+KIND_BITMAP = 1
+
+def postings_format(bin_path):
+    with open(bin_path, "rb") as f:
+        head = f.read(8)
+    if len(head) == 8 and head[:6] == POSTINGS_MAGIC:
+        return head[6], head[7]
+    return 0, CODEC_VARINT
+
+def unpack128(f):
+    bw = f.read(1)[0]
+    if bw == 0:
+        return [0] * SKIP_BLOCK
+    words = struct.unpack("<%dI" % (4 * bw), f.read(16 * bw))
+    mask = (1 << bw) - 1
+    out = []
+    for i in range(SKIP_BLOCK):
+        lane = i % 4
+        pos = (i // 4) * bw
+        w, sh = pos // 32, pos % 32
+        v = words[w * 4 + lane] >> sh
+        if sh + bw > 32:
+            v |= words[(w + 1) * 4 + lane] << (32 - sh)
+        out.append(v & mask)
+    return out
+
+def load_postings(bin_path, off, df, fmt=(0, CODEC_VARINT)):
+    version, codec = fmt
     res = []
     with open(bin_path, "rb") as f:
+        if version >= 2:
+            f.seek(off, os.SEEK_SET)
+            off += 1
+            if f.read(1)[0] == KIND_BITMAP:
+                n_words = struct.unpack("<I", f.read(4))[0]
+                words = struct.unpack("<%dQ" % n_words, f.read(8 * n_words))
+                for w, bits in enumerate(words):
+                    while bits:
+                        low = bits & -bits
+                        res.append(w * 64 + low.bit_length() - 1)
+                        bits ^= low
+                return res
+        if version >= 1 and df > SKIP_BLOCK:
+            off += 8 * ((df + SKIP_BLOCK - 1) // SKIP_BLOCK)
         f.seek(off, os.SEEK_SET)
         cur = 0
-        for i in range(df):
-            gap = read_varint(f)
-            cur = gap if i == 0 else (cur + gap)
-            res.append(cur)
+        left = df
+        while left > 0:
+            n = min(SKIP_BLOCK, left)
+            if codec == CODEC_BP128 and n == SKIP_BLOCK:
+                gaps = unpack128(f)
+            else:
+                gaps = [read_varint(f) for _ in range(n)]
+            for gap in gaps:
+                cur += gap
+                res.append(cur)
+            left -= n
     return res
 
 def intersect_sorted(a, b):
@@ -181,7 +235,7 @@ def to_rpn(tokens):
         out.append(st.pop())
     return out
 
-def eval_rpn(rpn, term_dict, postings_bin, n_docs):
+def eval_rpn(rpn, term_dict, postings_bin, n_docs, fmt=(0, CODEC_VARINT)):
     st = []
     for tt, txt in rpn:
         if tt == TT_TERM:
@@ -189,7 +243,7 @@ def eval_rpn(rpn, term_dict, postings_bin, n_docs):
                 st.append([])
             else:
                 off, df = term_dict[txt]
-                st.append(load_postings(postings_bin, off, df))
+                st.append(load_postings(postings_bin, off, df, fmt))
         elif tt == TT_NOT:
             if not st:
                 return []
@@ -203,13 +257,86 @@ def eval_rpn(rpn, term_dict, postings_bin, n_docs):
             st.append(intersect_sorted(a, b) if tt == TT_AND else union_sorted(a, b))
     return st[0] if len(st) == 1 else []
 
-def make_app(index_dir):
-    dict_path = os.path.join(index_dir, "dict.tsv")
-    docs_path = os.path.join(index_dir, "docs.tsv")
-    post_path = os.path.join(index_dir, "postings.bin")
+def engine_connect(engine):
+    if engine.startswith("unix:"):
+        sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        sock.connect(engine[len("unix:"):])
+    else:
+        addr = engine[len("tcp:"):] if engine.startswith("tcp:") else engine
+        host, port = addr.rsplit(":", 1)
+        sock = socket.create_connection((host, int(port)))
+    return sock
 
-    term_dict = load_dict(dict_path)
-    docs = load_docs(docs_path)
+def engine_query(engine, q, topk):
+    q = q.replace("\t", " ").replace("\r", " ").replace("\n", " ")
+    with engine_connect(engine) as sock:
+        sock.sendall(f"{topk}\t{q}\n".encode("utf-8"))
+        f = sock.makefile("rb")
+        head = f.readline().decode("utf-8", errors="replace").rstrip("\n").split(" ")
+        if len(head) != 3 or head[0] != "OK":
+            return 0, []
+        n_hits = int(head[1])
+        ids = []
+        for _ in range(int(head[2])):
+            line = f.readline().decode("utf-8", errors="replace")
+            ids.append(int(line.split("\t", 1)[0]))
+        return n_hits, ids
+
+# Segment directories in docID order: a sharded index (shards.tsv) lists its
+# shards, each an index of its own with a base and deltas (segments.tsv).
+def segment_dirs(index_dir):
+    shards = os.path.join(index_dir, "shards.tsv")
+    if os.path.exists(shards):
+        dirs = []
+        with open(shards, "r", encoding="utf-8") as f:
+            for line in f:
+                name = line.rstrip("\n").split("\t")[0]
+                if name:
+                    dirs.extend(segment_dirs(os.path.join(index_dir, name)))
+        return dirs
+    dirs = [index_dir]
+    manifest = os.path.join(index_dir, "segments.tsv")
+    if os.path.exists(manifest):
+        with open(manifest, "r", encoding="utf-8") as f:
+            for line in f:
+                parts = line.rstrip("\n").split("\t")
+                if len(parts) == 3:
+                    dirs.append(os.path.join(index_dir, parts[0]))
+    return dirs
+
+def load_segments(index_dir):
+    segs = []
+    base = 0
+    for d in segment_dirs(index_dir):
+        post_path = os.path.join(d, "postings.bin")
+        seg_docs = load_docs(os.path.join(d, "docs.tsv"))
+        segs.append((base, load_dict(os.path.join(d, "dict.tsv")), post_path, len(seg_docs), postings_format(post_path)))
+        base += len(seg_docs)
+    return segs
+
+def eval_segments(rpn, segs):
+    hits = []
+    for base, term_dict, post_path, n_docs, fmt in segs:
+        hits.extend(base + doc_id for doc_id in eval_rpn(rpn, term_dict, post_path, n_docs, fmt))
+    return hits
+
+def index_stemmer(index_dir):
+    path = os.path.join(index_dir, "stemmer.txt")
+    if not os.path.exists(path):
+        return "light"
+    with open(path, "r", encoding="utf-8") as f:
+        return f.read().strip()
+
+def make_app(index_dir, engine=None):
+    # The built-in evaluator only knows the light stemmer; other indexes go through --engine.
+    if not engine:
+        for d in segment_dirs(index_dir):
+            if index_stemmer(d) != "light":
+                raise SystemExit(f"{d} uses the {index_stemmer(d)} stemmer; run boolsearch --serve and pass --engine")
+    segs = load_segments(index_dir)
+    docs = []
+    for base, _, post_path, _, _ in segs:
+        docs.extend(load_docs(os.path.join(os.path.dirname(post_path), "docs.tsv")))
     n_docs = len(docs)
 
     app = Flask(__name__)
@@ -225,16 +352,19 @@ def make_app(index_dir):
 
         results_html = ""
         if q:
-            toks = query_tokenize(q)
-            rpn = to_rpn(toks)
-            hits = eval_rpn(rpn, term_dict, post_path, n_docs)
-            shown = hits[:topk_i]
+            if engine:
+                n_hits, shown = engine_query(engine, q, topk_i)
+            else:
+                toks = query_tokenize(q)
+                rpn = to_rpn(toks)
+                hits = eval_segments(rpn, segs)
+                n_hits, shown = len(hits), hits[:topk_i]
             items = []
             for doc_id in shown:
                 if 0 <= doc_id < n_docs:
                     src, path = docs[doc_id]
                     items.append(f"<li><b>{doc_id}</b> [{escape(src)}] {escape(path)}</li>")
-            results_html = f"<p>hits: {len(hits)}</p><ol>{''.join(items)}</ol>"
+            results_html = f"<p>hits: {n_hits}</p><ol>{''.join(items)}</ol>"
 
         html = f"""
 <!doctype html>
@@ -276,8 +406,9 @@ def main():
     ap.add_argument("--index_dir", default=os.path.join("out_bool", "index"))
     ap.add_argument("--host", default="127.0.0.1")
     ap.add_argument("--port", type=int, default=5000)
+    ap.add_argument("--engine", default=None, help="boolsearch --serve address: unix:/path or tcp:host:port")
     args = ap.parse_args()
-    app = make_app(args.index_dir)
+    app = make_app(args.index_dir, args.engine)
     app.run(host=args.host, port=args.port, debug=False, use_reloader=False)
 
 if __name__ == "__main__":
@@ -0,0 +1,166 @@
+#include "codec.hpp"
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace ir {
+
+using mystl::Vector;
+
+void write_varint(std::string& out, uint32_t v) {
+    while (v >= 0x80) {
+        out.push_back((char)((v & 0x7F) | 0x80));
+        v >>= 7;
+    }
+    out.push_back((char)(v & 0x7F));
+}
+
+// 128 gaps as 4 interleaved lanes of 32 values, so one 128-bit word holds the same slot of every lane.
+void pack128(const uint32_t* gaps, std::string& out) {
+    uint32_t bw = 0;
+    for (uint32_t i = 0; i < SKIP_BLOCK; ++i) {
+        while (bw < 32 && (gaps[i] >> bw) != 0) ++bw;
+    }
+    out.push_back((char)bw);
+
+    uint32_t words[4 * 32] = {0};
+    for (uint32_t i = 0; i < SKIP_BLOCK && bw > 0; ++i) {
+        uint32_t lane = i % 4;
+        uint32_t pos = (i / 4) * bw;
+        uint32_t w = pos / 32, sh = pos % 32;
+        words[w * 4 + lane] |= gaps[i] << sh;
+        if (sh + bw > 32) words[(w + 1) * 4 + lane] |= gaps[i] >> (32 - sh);
+    }
+    out.append((const char*)words, 16 * bw);
+}
+
+static void encode_bitmap(const Vector<uint32_t>& docs, uint32_t n_docs, std::string& out) {
+    uint32_t n_words = (n_docs + 63) / 64;
+    Vector<uint64_t> words;
+    words.resize(n_words);
+    for (size_t j = 0; j < docs.size(); ++j) words[docs[j] / 64] |= 1ULL << (docs[j] % 64);
+    out.clear();
+    out.push_back((char)KIND_BITMAP);
+    out.append((const char*)&n_words, sizeof(n_words));
+    out.append((const char*)words.data(), sizeof(uint64_t) * n_words);
+}
+
+void encode_postings(const Vector<uint32_t>& docs, uint32_t n_docs, uint8_t codec, std::string& out) {
+    if ((uint64_t)docs.size() * 8 >= n_docs && docs.size() > SKIP_BLOCK) {
+        encode_bitmap(docs, n_docs, out);
+        return;
+    }
+    std::string gaps;
+    Vector<SkipEntry> skips;
+    uint32_t prev = 0;
+    uint32_t block[SKIP_BLOCK];
+    for (size_t j = 0; j < docs.size(); j += SKIP_BLOCK) {
+        size_t n = docs.size() - j;
+        if (n > SKIP_BLOCK) n = SKIP_BLOCK;
+        skips.push_back({docs[j], (uint32_t)gaps.size()});
+        for (size_t k = 0; k < n; ++k) {
+            uint32_t v = docs[j + k];
+            block[k] = (j + k == 0) ? v : (v - prev);
+            prev = v;
+        }
+        if (codec == CODEC_BP128 && n == SKIP_BLOCK) pack128(block, gaps);
+        else for (size_t k = 0; k < n; ++k) write_varint(gaps, block[k]);
+    }
+    out.clear();
+    out.push_back((char)KIND_LIST);
+    if (docs.size() > SKIP_BLOCK) out.append((const char*)skips.data(), sizeof(SkipEntry) * skips.size());
+    out += gaps;
+}
+
+void unpack128(const uint8_t* in, uint32_t bw, uint32_t* out) {
+    if (bw == 0) { std::memset(out, 0, sizeof(uint32_t) * SKIP_BLOCK); return; }
+#if defined(__SSE2__)
+    const __m128i mask = _mm_set1_epi32(bw == 32 ? -1 : (int)((1u << bw) - 1));
+    const __m128i* src = (const __m128i*)in;
+    __m128i w = _mm_loadu_si128(src++);
+    uint32_t shift = 0;
+    for (uint32_t k = 0; k < 32; ++k) {
+        __m128i v = _mm_srl_epi32(w, _mm_cvtsi32_si128((int)shift));
+        shift += bw;
+        if (shift >= 32) {
+            shift -= 32;
+            if (k + 1 < 32) {
+                w = _mm_loadu_si128(src++);
+                if (shift) v = _mm_or_si128(v, _mm_sll_epi32(w, _mm_cvtsi32_si128((int)(bw - shift))));
+            }
+        }
+        _mm_storeu_si128((__m128i*)(out + 4 * k), _mm_and_si128(v, mask));
+    }
+#else
+    uint32_t words[4 * 32];
+    std::memcpy(words, in, 16 * bw);
+    uint32_t mask = (bw == 32) ? 0xFFFFFFFFu : ((1u << bw) - 1);
+    for (uint32_t i = 0; i < SKIP_BLOCK; ++i) {
+        uint32_t lane = i % 4;
+        uint32_t pos = (i / 4) * bw;
+        uint32_t wi = pos / 32, sh = pos % 32;
+        uint32_t v = words[wi * 4 + lane] >> sh;
+        if (sh + bw > 32) v |= words[(wi + 1) * 4 + lane] << (32 - sh);
+        out[i] = v & mask;
+    }
+#endif
+}
+
+void prefix_sum128(uint32_t* v, uint32_t base) {
+#if defined(__SSE2__)
+    __m128i carry = _mm_set1_epi32((int)base);
+    for (uint32_t i = 0; i < SKIP_BLOCK; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(v + i));
+        x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+        x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+        x = _mm_add_epi32(x, carry);
+        _mm_storeu_si128((__m128i*)(v + i), x);
+        carry = _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+    }
+#else
+    for (uint32_t i = 0; i < SKIP_BLOCK; ++i) { base += v[i]; v[i] = base; }
+#endif
+}
+
+void decode_postings(const uint8_t* p, const uint8_t* end, uint32_t df, uint8_t version, uint8_t codec,
+                            uint32_t doc_base, Vector<uint32_t>& out) {
+    out.resize(df);
+    uint32_t* o = out.data();
+    size_t n_out = 0;
+    if (version >= 2 && p < end && *p++ == KIND_BITMAP) {
+        uint32_t n_words = 0;
+        std::memcpy(&n_words, p, sizeof(n_words));
+        p += sizeof(n_words);
+        for (uint32_t w = 0; w < n_words && p + sizeof(uint64_t) <= end; ++w, p += sizeof(uint64_t)) {
+            uint64_t bits;
+            std::memcpy(&bits, p, sizeof(bits));
+            while (bits && n_out < df) {
+                o[n_out++] = doc_base + w * 64 + (uint32_t)__builtin_ctzll(bits);
+                bits &= bits - 1;
+            }
+        }
+        out.resize(n_out);
+        return;
+    }
+    if (version >= 1 && df > SKIP_BLOCK) p += sizeof(SkipEntry) * (size_t)((df + SKIP_BLOCK - 1) / SKIP_BLOCK);
+
+    uint32_t cur = 0;
+    uint32_t block[SKIP_BLOCK];
+    for (uint32_t j = 0; j < df; j += SKIP_BLOCK) {
+        uint32_t n = (df - j < SKIP_BLOCK) ? df - j : SKIP_BLOCK;
+        if (codec == CODEC_BP128 && n == SKIP_BLOCK && p < end) {
+            uint32_t bw = *p++;
+            unpack128(p, bw, block);
+            p += 16 * bw;
+        } else {
+            for (uint32_t k = 0; k < n; ++k) block[k] = read_varint(p, end);
+        }
+        for (uint32_t k = 0; k < n; ++k) {
+            cur += block[k];
+            o[n_out++] = doc_base + cur;
+        }
+    }
+}
+
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "../mystl/vector.hpp"
+#include "index_format.hpp"
+
+namespace ir {
+
+inline uint32_t read_varint(const uint8_t*& p, const uint8_t* end) {
+    uint32_t v = 0;
+    uint32_t shift = 0;
+    while (p < end) {
+        uint8_t b = *p++;
+        v |= (uint32_t)(b & 0x7F) << shift;
+        if ((b & 0x80) == 0) break;
+        shift += 7;
+    }
+    return v;
+}
+
+void write_varint(std::string& out, uint32_t v);
+
+void pack128(const uint32_t* gaps, std::string& out);
+void unpack128(const uint8_t* in, uint32_t bw, uint32_t* out);
+void prefix_sum128(uint32_t* v, uint32_t base);
+
+void encode_postings(const mystl::Vector<uint32_t>& docs, uint32_t n_docs, uint8_t codec, std::string& out);
+void decode_postings(const uint8_t* p, const uint8_t* end, uint32_t df, uint8_t version, uint8_t codec,
+                     uint32_t doc_base, mystl::Vector<uint32_t>& out);
+
+}
@@ -0,0 +1,147 @@
+#include "dict_fc.hpp"
+#include "codec.hpp"
+#include <cstring>
+
+namespace ir {
+
+void FrontCodedWriter::add(std::string_view term, uint64_t offset, uint32_t df) {
+    if (n_ % DICT_FC_BLOCK == 0) {
+        blocks_.push_back({offset, (uint64_t)data_.size()});
+        write_varint(data_, (uint32_t)term.size());
+        data_.append(term.data(), term.size());
+    } else {
+        size_t shared = 0;
+        while (shared < prev_.size() && shared < term.size() && prev_[shared] == term[shared]) ++shared;
+        write_varint(data_, (uint32_t)shared);
+        write_varint(data_, (uint32_t)(term.size() - shared));
+        data_.append(term.data() + shared, term.size() - shared);
+        write_varint(data_, (uint32_t)(offset - prev_off_));
+    }
+    write_varint(data_, df);
+    prev_.assign(term.data(), term.size());
+    prev_off_ = offset;
+    ++n_;
+}
+
+void FrontCodedWriter::finish(std::string& out) const {
+    DictFcHeader h;
+    std::memcpy(h.magic, DICT_FC_MAGIC, 8);
+    h.n_terms = n_;
+    h.block_size = DICT_FC_BLOCK;
+    h.n_blocks = (uint32_t)blocks_.size();
+    h.reserved = 0;
+    h.data_size = data_.size();
+    out.clear();
+    out.append((const char*)&h, sizeof(h));
+    out.append((const char*)blocks_.data(), sizeof(DictFcBlock) * blocks_.size());
+    out += data_;
+}
+
+namespace {
+
+// Walks the entries of one block, rebuilding each term from the previous one.
+struct BlockReader {
+    const uint8_t* p;
+    const uint8_t* end;
+    uint32_t left;
+    uint64_t off;
+    uint32_t ord;
+    bool first = true;
+    std::string term;
+
+    BlockReader(const uint8_t* p_, const uint8_t* end_, uint32_t left_, uint64_t off_, uint32_t ord_)
+        : p(p_), end(end_), left(left_), off(off_), ord(ord_) {}
+
+    bool next(TermInfo& ti) {
+        if (!left || p >= end) return false;
+        if (first) {
+            uint32_t len = read_varint(p, end);
+            if ((size_t)(end - p) < len) return false;
+            term.assign((const char*)p, len);
+            p += len;
+            first = false;
+        } else {
+            uint32_t shared = read_varint(p, end);
+            uint32_t len = read_varint(p, end);
+            if (shared > term.size() || (size_t)(end - p) < len) return false;
+            term.resize(shared);
+            term.append((const char*)p, len);
+            p += len;
+            off += read_varint(p, end);
+        }
+        ti.offset = off;
+        ti.df = read_varint(p, end);
+        ti.ord = ord++;
+        --left;
+        return true;
+    }
+};
+
+}
+
+bool FrontCodedDict::open(const char* data, size_t size) {
+    if (size < sizeof(DictFcHeader)) return false;
+    const DictFcHeader* h = (const DictFcHeader*)data;
+    if (std::memcmp(h->magic, DICT_FC_MAGIC, 8) != 0 || h->block_size == 0) return false;
+    size_t table = sizeof(DictFcBlock) * (size_t)h->n_blocks;
+    if (size < sizeof(DictFcHeader) + table + h->data_size) return false;
+    if ((uint64_t)h->n_blocks * h->block_size < h->n_terms) return false;
+    blocks_ = (const DictFcBlock*)(data + sizeof(DictFcHeader));
+    data_ = (const uint8_t*)(data + sizeof(DictFcHeader) + table);
+    data_end_ = data_ + h->data_size;
+    n_terms_ = h->n_terms;
+    n_blocks_ = h->n_blocks;
+    block_size_ = h->block_size;
+    return true;
+}
+
+std::string_view FrontCodedDict::head(uint32_t b) const {
+    const uint8_t* p = data_ + blocks_[b].data_off;
+    if (p >= data_end_) return std::string_view();
+    uint32_t len = read_varint(p, data_end_);
+    if ((size_t)(data_end_ - p) < len) return std::string_view();
+    return std::string_view((const char*)p, len);
+}
+
+// Last block whose head is <= key (0 when key sorts before every term).
+uint32_t FrontCodedDict::block_for(std::string_view key) const {
+    uint32_t lo = 0, hi = n_blocks_;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (head(mid) <= key) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo ? lo - 1 : 0;
+}
+
+bool FrontCodedDict::find(std::string_view term, TermInfo& out) const {
+    if (!n_blocks_) return false;
+    uint32_t b = block_for(term);
+    uint32_t start = b * block_size_;
+    BlockReader r{data_ + blocks_[b].data_off, data_end_,
+                  (n_terms_ - start < block_size_) ? n_terms_ - start : block_size_, blocks_[b].post_off, start};
+    TermInfo ti;
+    while (r.next(ti)) {
+        int c = std::string_view(r.term).compare(term);
+        if (c == 0) { out = ti; return true; }
+        if (c > 0) return false;
+    }
+    return false;
+}
+
+void FrontCodedDict::prefix(std::string_view prefix, mystl::Vector<TermInfo>& out) const {
+    if (!n_blocks_) return;
+    for (uint32_t b = block_for(prefix); b < n_blocks_; ++b) {
+        uint32_t start = b * block_size_;
+        BlockReader r{data_ + blocks_[b].data_off, data_end_,
+                      (n_terms_ - start < block_size_) ? n_terms_ - start : block_size_, blocks_[b].post_off, start};
+        TermInfo ti;
+        while (r.next(ti)) {
+            std::string_view t(r.term);
+            if (t.compare(0, prefix.size(), prefix) == 0) out.push_back(ti);
+            else if (t > prefix) return;
+        }
+    }
+}
+
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "../mystl/vector.hpp"
+#include "index_format.hpp"
+
+namespace ir {
+
+struct TermInfo {
+    uint64_t offset = 0;
+    uint32_t df = 0;
+    uint32_t ord = 0;
+};
+
+// Builds dict.fc in memory; terms must be added in sorted order with
+// non-decreasing postings offsets.
+class FrontCodedWriter {
+public:
+    void add(std::string_view term, uint64_t offset, uint32_t df);
+    void finish(std::string& out) const;
+    uint32_t size() const { return n_; }
+
+private:
+    mystl::Vector<DictFcBlock> blocks_;
+    std::string data_;
+    std::string prev_;
+    uint64_t prev_off_ = 0;
+    uint32_t n_ = 0;
+};
+
+// Read-only view over a dict.fc image (usually mmapped).
+class FrontCodedDict {
+public:
+    bool open(const char* data, size_t size);
+    uint32_t size() const { return n_terms_; }
+
+    bool find(std::string_view term, TermInfo& out) const;
+    // Appends every term starting with `prefix`, in dictionary order.
+    void prefix(std::string_view prefix, mystl::Vector<TermInfo>& out) const;
+
+private:
+    std::string_view head(uint32_t b) const;
+    uint32_t block_for(std::string_view key) const;
+
+    const DictFcBlock* blocks_ = nullptr;
+    const uint8_t* data_ = nullptr;
+    const uint8_t* data_end_ = nullptr;
+    uint32_t n_terms_ = 0;
+    uint32_t n_blocks_ = 0;
+    uint32_t block_size_ = 0;
+};
+
+}
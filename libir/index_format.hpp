@@ -0,0 +1,112 @@
+#pragma once
+#include <cstdint>
+
+namespace ir {
+
+struct DictBinHeader {
+    char magic[8];
+    uint32_t n_terms;
+    uint32_t reserved;
+    uint64_t strings_size;
+};
+
+struct DictBinEntry {
+    uint64_t offset;
+    uint64_t term_off;
+    uint32_t term_len;
+    uint32_t df;
+};
+
+// dict.fc: front-coded term dictionary. Terms are grouped into blocks of
+// DICT_FC_BLOCK; each block stores its first term whole and the rest as
+// (shared prefix, suffix), and the block table allows binary search over heads.
+struct DictFcHeader {
+    char magic[8];
+    uint32_t n_terms;
+    uint32_t block_size;
+    uint32_t n_blocks;
+    uint32_t reserved;
+    uint64_t data_size;
+};
+
+struct DictFcBlock {
+    uint64_t post_off;
+    uint64_t data_off;
+};
+
+struct DocsBinHeader {
+    char magic[8];
+    uint32_t n_docs;
+    uint32_t reserved;
+    uint64_t strings_size;
+};
+
+struct DocsBinEntry {
+    uint64_t path_off;
+    uint32_t path_len;
+    uint32_t source;
+};
+
+// tf.bin: within-document term frequencies, one record per term in dictionary
+// order. A record is one TfBlockMax per SKIP_BLOCK postings followed by one tf
+// byte per posting (saturated at 255); the per-term offset table is at table_off.
+struct TfHeader {
+    char magic[8];
+    uint32_t n_terms;
+    uint32_t reserved;
+    uint64_t table_off;
+};
+
+struct TfBlockMax {
+    uint32_t max_tf;
+    uint32_t min_len;
+};
+
+// pos.bin (optional): token positions, one record per term in dictionary
+// order. A record is a uint32 offset per SKIP_BLOCK postings into the stream
+// that follows; per posting the stream holds varint(first + 1), varint gaps to
+// the following positions, then a 0 byte. Varints are minimal, so 0 bytes only
+// ever end a posting and can be skipped with memchr. Same header as tf.bin.
+struct PosHeader {
+    char magic[8];
+    uint32_t n_terms;
+    uint32_t reserved;
+    uint64_t table_off;
+};
+
+// doclen.bin: indexed token count of every document, by local docID.
+struct DocLenHeader {
+    char magic[8];
+    uint32_t n_docs;
+    uint32_t reserved;
+    uint64_t total_len;
+};
+
+struct PostingsHeader {
+    char magic[6];
+    uint8_t version;
+    uint8_t codec;
+};
+
+struct SkipEntry {
+    uint32_t first_doc;
+    uint32_t byte_off;
+};
+
+static const char POSTINGS_MAGIC[6] = {'I','R','P','O','S','T'};
+static const uint8_t POSTINGS_VERSION = 2;
+static const uint8_t KIND_LIST = 0;
+static const uint8_t KIND_BITMAP = 1;
+static const uint32_t SKIP_BLOCK = 128;
+static const uint8_t CODEC_VARINT = 0;
+static const uint8_t CODEC_BP128 = 1;
+
+static const char DICT_BIN_MAGIC[8] = {'I','R','D','I','C','T','1','\0'};
+static const char DICT_FC_MAGIC[8] = {'I','R','D','I','C','F','C','1'};
+static const uint32_t DICT_FC_BLOCK = 32;
+static const char DOCS_BIN_MAGIC[8] = {'I','R','D','O','C','S','1','\0'};
+static const char TF_MAGIC[8] = {'I','R','T','F','R','Q','1','\0'};
+static const char POS_MAGIC[8] = {'I','R','P','O','S','N','1','\0'};
+static const char DOCLEN_MAGIC[8] = {'I','R','D','L','E','N','1','\0'};
+
+}
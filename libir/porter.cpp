@@ -0,0 +1,180 @@
+#include "text.hpp"
+#include "suffix_trie.hpp"
+
+namespace ir {
+
+// Porter (1980) as in Martin Porter's reference C implementation, including its
+// two documented departures (step 2 maps "bli" to "ble" and "logi" to "log").
+// Steps 2-4 look their suffix up in compile-time tries instead of testing each
+// rule in turn; the first three steps keep the reference's explicit tests.
+namespace {
+
+constexpr const char* STEP2_SUF[] = {"ational", "tional", "enci", "anci", "izer", "bli", "alli", "entli", "eli",
+                                     "ousli", "ization", "ation", "ator", "alism", "iveness", "fulness", "ousness",
+                                     "aliti", "iviti", "biliti", "logi"};
+constexpr const char* STEP2_REP[] = {"ate", "tion", "ence", "ance", "ize", "ble", "al", "ent", "e",
+                                     "ous", "ize", "ate", "ate", "al", "ive", "ful", "ous",
+                                     "al", "ive", "ble", "log"};
+constexpr const char* STEP3_SUF[] = {"icate", "ative", "alize", "iciti", "ical", "ful", "ness"};
+constexpr const char* STEP3_REP[] = {"ic", "", "al", "ic", "ic", "", ""};
+// "ion" only counts after s or t (checked by the caller).
+constexpr const char* STEP4_SUF[] = {"al", "ance", "ence", "er", "ic", "able", "ible", "ant", "ement", "ment",
+                                     "ent", "ion", "ou", "ism", "ate", "iti", "ous", "ive", "ize"};
+constexpr size_t STEP4_ION = 11;
+
+constexpr SuffixTrie<96> STEP2(STEP2_SUF, sizeof(STEP2_SUF) / sizeof(STEP2_SUF[0]));
+constexpr SuffixTrie<40> STEP3(STEP3_SUF, sizeof(STEP3_SUF) / sizeof(STEP3_SUF[0]));
+constexpr SuffixTrie<64> STEP4(STEP4_SUF, sizeof(STEP4_SUF) / sizeof(STEP4_SUF[0]));
+
+static_assert(sizeof(STEP2_SUF) == sizeof(STEP2_REP), "one replacement per step 2 suffix");
+static_assert(sizeof(STEP3_SUF) == sizeof(STEP3_REP), "one replacement per step 3 suffix");
+
+// b[0..k] is the word; j marks the end of the stem left by the last ends().
+struct Porter {
+    char* b;
+    int k;
+    int j = 0;
+
+    bool cons(int i) const {
+        switch (b[i]) {
+            case 'a': case 'e': case 'i': case 'o': case 'u': return false;
+            case 'y': return i == 0 ? true : !cons(i - 1);
+            default: return true;
+        }
+    }
+
+    // Number of VC sequences in b[0..j].
+    int m() const {
+        int n = 0, i = 0;
+        for (;; ++i) {
+            if (i > j) return n;
+            if (!cons(i)) break;
+        }
+        ++i;
+        for (;;) {
+            for (;; ++i) {
+                if (i > j) return n;
+                if (cons(i)) break;
+            }
+            ++i;
+            ++n;
+            for (;; ++i) {
+                if (i > j) return n;
+                if (!cons(i)) break;
+            }
+            ++i;
+        }
+    }
+
+    bool vowel_in_stem() const {
+        for (int i = 0; i <= j; ++i) if (!cons(i)) return true;
+        return false;
+    }
+
+    bool double_cons(int i) const { return i >= 1 && b[i] == b[i - 1] && cons(i); }
+
+    // Consonant-vowel-consonant ending at i, the last consonant not w, x or y.
+    bool cvc(int i) const {
+        if (i < 2 || !cons(i) || cons(i - 1) || !cons(i - 2)) return false;
+        return b[i] != 'w' && b[i] != 'x' && b[i] != 'y';
+    }
+
+    bool ends(const char* s) {
+        int len = 0;
+        while (s[len]) ++len;
+        if (len > k + 1) return false;
+        for (int i = 0; i < len; ++i) if (b[k - len + 1 + i] != s[i]) return false;
+        j = k - len;
+        return true;
+    }
+
+    void set_to(const char* s) {
+        int len = 0;
+        while (s[len]) ++len;
+        for (int i = 0; i < len; ++i) b[j + 1 + i] = s[i];
+        k = j + len;
+    }
+
+    void replace_if_m(const char* s) { if (m() > 0) set_to(s); }
+
+    // Looks b[0..k] up in a step trie; on a hit j is set as ends() would.
+    template <size_t N>
+    int lookup(const SuffixTrie<N>& t) {
+        size_t len = 0;
+        int r = t.match(b, (size_t)k + 1, len);
+        if (r >= 0) j = k - (int)len;
+        return r;
+    }
+
+    void step1ab() {
+        if (b[k] == 's') {
+            if (ends("sses")) k -= 2;
+            else if (ends("ies")) set_to("i");
+            else if (b[k - 1] != 's') --k;
+        }
+        if (ends("eed")) {
+            if (m() > 0) --k;
+        } else if ((ends("ed") || ends("ing")) && vowel_in_stem()) {
+            k = j;
+            if (ends("at")) set_to("ate");
+            else if (ends("bl")) set_to("ble");
+            else if (ends("iz")) set_to("ize");
+            else if (double_cons(k)) {
+                --k;
+                char c = b[k];
+                if (c == 'l' || c == 's' || c == 'z') ++k;
+            } else if (m() == 1 && cvc(k)) {
+                set_to("e");
+            }
+        }
+    }
+
+    void step1c() {
+        if (ends("y") && vowel_in_stem()) b[k] = 'i';
+    }
+
+    void step2() {
+        int r = lookup(STEP2);
+        if (r >= 0) replace_if_m(STEP2_REP[r]);
+    }
+
+    void step3() {
+        int r = lookup(STEP3);
+        if (r >= 0) replace_if_m(STEP3_REP[r]);
+    }
+
+    void step4() {
+        int r = lookup(STEP4);
+        if (r < 0) return;
+        if ((size_t)r == STEP4_ION && !(j >= 0 && (b[j] == 's' || b[j] == 't'))) return;
+        if (m() > 1) k = j;
+    }
+
+    // m() measures up to the original end in both tests, as in the reference.
+    void step5() {
+        j = k;
+        if (b[k] == 'e') {
+            int a = m();
+            if (a > 1 || (a == 1 && !cvc(k - 1))) --k;
+        }
+        if (b[k] == 'l' && double_cons(k) && m() > 1) --k;
+    }
+};
+
+}
+
+void porter_stem_inplace(std::string& w) {
+    if (w.size() <= 2) return;
+    Porter p{&w[0], (int)w.size() - 1};
+    p.step1ab();
+    if (p.k > 0) {
+        p.step1c();
+        p.step2();
+        p.step3();
+        p.step4();
+        p.step5();
+    }
+    w.resize((size_t)p.k + 1);
+}
+
+}
@@ -0,0 +1,110 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "../mystl/vector.hpp"
+
+namespace ir {
+
+// Set operations on sorted docID lists, shared by the evaluator and the benchmarks.
+
+inline size_t gallop(const mystl::Vector<uint32_t>& v, size_t from, uint32_t target) {
+    size_t step = 1;
+    size_t lo = from, hi = from;
+    while (hi < v.size() && v[hi] < target) {
+        lo = hi + 1;
+        hi += step;
+        step *= 2;
+    }
+    if (hi > v.size()) hi = v.size();
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (v[mid] < target) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+inline mystl::Vector<uint32_t> intersect_sorted(const mystl::Vector<uint32_t>& a, const mystl::Vector<uint32_t>& b) {
+    mystl::Vector<uint32_t> r;
+    if (a.size() > b.size()) return intersect_sorted(b, a);
+    if (a.size() * 32 < b.size()) {
+        size_t j = 0;
+        for (size_t i = 0; i < a.size() && j < b.size(); ++i) {
+            j = gallop(b, j, a[i]);
+            if (j < b.size() && b[j] == a[i]) r.push_back(a[i]);
+        }
+        return r;
+    }
+    size_t i = 0, j = 0;
+    while (i < a.size() && j < b.size()) {
+        uint32_t x = a[i], y = b[j];
+        if (x == y) { r.push_back(x); ++i; ++j; }
+        else if (x < y) ++i;
+        else ++j;
+    }
+    return r;
+}
+
+inline mystl::Vector<uint32_t> union_sorted(const mystl::Vector<uint32_t>& a, const mystl::Vector<uint32_t>& b) {
+    mystl::Vector<uint32_t> r;
+    size_t i = 0, j = 0;
+    while (i < a.size() || j < b.size()) {
+        if (j >= b.size() || (i < a.size() && a[i] < b[j])) r.push_back(a[i++]);
+        else if (i >= a.size() || (j < b.size() && b[j] < a[i])) r.push_back(b[j++]);
+        else { r.push_back(a[i]); ++i; ++j; }
+    }
+    return r;
+}
+
+inline mystl::Vector<uint32_t> difference_sorted(const mystl::Vector<uint32_t>& a, const mystl::Vector<uint32_t>& b) {
+    mystl::Vector<uint32_t> r;
+    size_t j = 0;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (j < b.size() && b[j] < a[i]) j = gallop(b, j, a[i]);
+        if (j >= b.size() || b[j] != a[i]) r.push_back(a[i]);
+    }
+    return r;
+}
+
+// k-way merge of sorted id lists: a binary min-heap of list heads, so each id
+// costs O(log k) instead of one pass over a growing intermediate per operand.
+inline mystl::Vector<uint32_t> union_k(const mystl::Vector<const mystl::Vector<uint32_t>*>& lists) {
+    struct Head { uint32_t doc; uint32_t list; };
+    mystl::Vector<Head> heap;
+    mystl::Vector<size_t> at;
+    at.resize(lists.size());
+    size_t total = 0;
+    for (size_t k = 0; k < lists.size(); ++k) {
+        total += lists[k]->size();
+        if (!lists[k]->empty()) heap.push_back({(*lists[k])[0], (uint32_t)k});
+    }
+    auto sift_down = [&](size_t i) {
+        for (;;) {
+            size_t l = 2 * i + 1, r = l + 1, m = i;
+            if (l < heap.size() && heap[l].doc < heap[m].doc) m = l;
+            if (r < heap.size() && heap[r].doc < heap[m].doc) m = r;
+            if (m == i) return;
+            Head tmp = heap[i]; heap[i] = heap[m]; heap[m] = tmp;
+            i = m;
+        }
+    };
+    for (size_t i = heap.size() / 2; i-- > 0;) sift_down(i);
+
+    mystl::Vector<uint32_t> r;
+    r.reserve(total);
+    while (!heap.empty()) {
+        Head& h = heap[0];
+        if (r.empty() || r[r.size() - 1] != h.doc) r.push_back(h.doc);
+        const mystl::Vector<uint32_t>& v = *lists[h.list];
+        if (++at[h.list] < v.size()) {
+            h.doc = v[at[h.list]];
+        } else {
+            heap[0] = heap[heap.size() - 1];
+            heap.pop_back();
+        }
+        sift_down(0);
+    }
+    return r;
+}
+
+}
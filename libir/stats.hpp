@@ -0,0 +1,113 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+namespace ir {
+
+// Process-wide counters behind --stats and the metrics endpoint. Each Stat is a
+// static object that links itself into one list during static initialization.
+// Updates are relaxed atomic adds, so callers bump them once per document,
+// list or operation, never per token.
+//
+// STAT_NANOS values are durations in nanoseconds and are reported in seconds;
+// with several threads they add up thread time, not wall time. STAT_MAX keeps
+// the largest value seen; STAT_GAUGE is set from elsewhere right before rendering.
+enum StatKind : uint8_t { STAT_COUNT, STAT_NANOS, STAT_MAX, STAT_GAUGE };
+
+struct Stat;
+
+struct StatList {
+    Stat* head = nullptr;
+    Stat* tail = nullptr;
+};
+
+inline StatList& stat_list() {
+    static StatList l;
+    return l;
+}
+
+struct Stat {
+    const char* name;
+    const char* help;
+    StatKind kind;
+    std::atomic<uint64_t> value{0};
+    Stat* next = nullptr;
+
+    Stat(const char* name_, StatKind kind_, const char* help_) : name(name_), help(help_), kind(kind_) {
+        StatList& l = stat_list();
+        if (l.tail) l.tail->next = this;
+        else l.head = this;
+        l.tail = this;
+    }
+
+    Stat(const Stat&) = delete;
+    Stat& operator=(const Stat&) = delete;
+
+    void add(uint64_t v) { value.fetch_add(v, std::memory_order_relaxed); }
+    void set(uint64_t v) { value.store(v, std::memory_order_relaxed); }
+    uint64_t get() const { return value.load(std::memory_order_relaxed); }
+
+    void max(uint64_t v) {
+        uint64_t cur = get();
+        while (v > cur && !value.compare_exchange_weak(cur, v, std::memory_order_relaxed)) {}
+    }
+};
+
+inline uint64_t now_ns() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Adds the lifetime of the scope to a STAT_NANOS counter.
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Stat& s) : s_(s), t0_(now_ns()) {}
+    ~ScopedTimer() { s_.add(now_ns() - t0_); }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    Stat& s_;
+    uint64_t t0_;
+};
+
+inline std::string stat_value(const Stat& s) {
+    if (s.kind != STAT_NANOS) return std::to_string(s.get());
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.6f", (double)s.get() / 1e9);
+    return buf;
+}
+
+// One flat JSON object: {"tool": "<tool>", "<name>": <value>, ...}.
+inline std::string stats_json(const char* tool) {
+    std::string out = "{\n  \"tool\": \"";
+    out += tool;
+    out += '"';
+    for (const Stat* s = stat_list().head; s; s = s->next) {
+        out += ",\n  \"";
+        out += s->name;
+        out += "\": ";
+        out += stat_value(*s);
+    }
+    out += "\n}\n";
+    return out;
+}
+
+// Prometheus text exposition format; counters get the conventional _total suffix.
+inline std::string stats_prometheus(const char* prefix) {
+    std::string out;
+    for (const Stat* s = stat_list().head; s; s = s->next) {
+        bool counter = s->kind == STAT_COUNT || s->kind == STAT_NANOS;
+        std::string name = std::string(prefix) + "_" + s->name + (counter ? "_total" : "");
+        out += "# HELP " + name + " " + s->help + "\n";
+        out += "# TYPE " + name + (counter ? " counter\n" : " gauge\n");
+        out += name + " " + stat_value(*s) + "\n";
+    }
+    return out;
+}
+
+}
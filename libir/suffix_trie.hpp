@@ -0,0 +1,65 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace ir {
+
+// Trie over reversed suffixes, built by a constexpr constructor, so a rule
+// table compiles into static data. match() walks a word backwards from its end
+// once and reports the longest suffix in the table; each step scans the
+// siblings of one node, which are the distinct letters rules have at that depth.
+template <size_t MaxNodes>
+struct SuffixTrie {
+    struct Node {
+        char c = 0;
+        uint8_t child = 0;
+        uint8_t sibling = 0;
+        int8_t rule = -1;
+    };
+
+    static_assert(MaxNodes < 256, "node links are 8-bit");
+
+    Node nodes[MaxNodes];
+    size_t n_nodes = 1;
+
+    // Rule r is suffixes[r]; node 0 is the root and never a child, so 0 means "none".
+    constexpr SuffixTrie(const char* const* suffixes, size_t n_rules) : nodes() {
+        for (size_t r = 0; r < n_rules; ++r) {
+            size_t len = 0;
+            while (suffixes[r][len]) ++len;
+            size_t at = 0;
+            for (size_t i = len; i-- > 0;) {
+                char c = suffixes[r][i];
+                size_t k = nodes[at].child;
+                while (k && nodes[k].c != c) k = nodes[k].sibling;
+                if (!k) {
+                    k = n_nodes++;
+                    nodes[k].c = c;
+                    nodes[k].sibling = nodes[at].child;
+                    nodes[at].child = (uint8_t)k;
+                }
+                at = k;
+            }
+            nodes[at].rule = (int8_t)r;
+        }
+    }
+
+    // Rule of the longest table suffix of s[0..len), or -1; its length goes to mlen.
+    constexpr int match(const char* s, size_t len, size_t& mlen) const {
+        int best = -1;
+        size_t at = 0;
+        for (size_t i = len; i-- > 0;) {
+            size_t k = nodes[at].child;
+            while (k && nodes[k].c != s[i]) k = nodes[k].sibling;
+            if (!k) break;
+            at = k;
+            if (nodes[at].rule >= 0) {
+                best = nodes[at].rule;
+                mlen = len - i;
+            }
+        }
+        return best;
+    }
+};
+
+}
@@ -0,0 +1,73 @@
+#include "text.hpp"
+#include <cstdio>
+#include <fstream>
+#include "tokenize.hpp"
+
+namespace ir {
+
+void tokenize_line(const std::string& line, mystl::Vector<std::string>& out_tokens) {
+    TokenStream ts(line.data(), line.size());
+    std::string_view tok;
+    while (ts.next(tok)) out_tokens.push_back(std::string(tok));
+}
+
+bool ends_with(const std::string& s, const char* suf) {
+    size_t n = s.size();
+    size_t m = 0;
+    while (suf[m]) ++m;
+    if (m > n) return false;
+    for (size_t i = 0; i < m; ++i) if (s[n - m + i] != suf[i]) return false;
+    return true;
+}
+
+// One pass over the last bytes: the "'s" and plural endings are settled first,
+// then a switch on the final letter picks the one derivational ending that can
+// apply. Equivalent to testing the rules in order with ends_with().
+void stem_inplace(std::string& w) {
+    size_t n = w.size();
+    if (n < 4) return;
+    const char* s = w.data();
+    if (s[n - 1] == 's' && s[n - 2] == '\'') n -= 2;
+
+    if (s[n - 1] == 's') {
+        if (n > 6 && s[n - 2] == 'e' && s[n - 3] == 's' && s[n - 4] == 's') { w.resize(n - 2); return; }
+        if (n > 5 && s[n - 2] == 'e' && s[n - 3] == 'i') { w[n - 3] = 'y'; w.resize(n - 2); return; }
+        if (n > 4 && s[n - 2] != 's') --n;
+    }
+
+    switch (s[n - 1]) {
+        case 'g': if (n > 6 && s[n - 2] == 'n' && s[n - 3] == 'i') n -= 3; break;
+        case 'd': if (n > 5 && s[n - 2] == 'e') n -= 2; break;
+        case 'y': if (n > 6 && s[n - 2] == 'l') n -= 2; break;
+        case 't': if (n > 8 && s[n - 2] == 'n' && s[n - 3] == 'e' && s[n - 4] == 'm') n -= 4; break;
+    }
+    w.resize(n);
+}
+
+bool parse_stem_mode(const std::string& name, StemMode& out) {
+    if (name == "light") { out = STEM_LIGHT; return true; }
+    if (name == "porter") { out = STEM_PORTER; return true; }
+    return false;
+}
+
+const char* stem_mode_name(StemMode m) { return m == STEM_PORTER ? "porter" : "light"; }
+
+bool read_stem_mode(const std::string& index_dir, StemMode& out) {
+    out = STEM_LIGHT;
+    std::ifstream in(index_dir + "/stemmer.txt", std::ios::binary);
+    if (!in) return true;
+    std::string name;
+    in >> name;
+    return parse_stem_mode(name, out);
+}
+
+// Light indexes get no file, so they stay identical to ones built before the
+// option; a light rebuild removes the file an earlier build may have left.
+void write_stem_mode(const std::string& index_dir, StemMode m) {
+    std::string path = index_dir + "/stemmer.txt";
+    if (m == STEM_LIGHT) { std::remove(path.c_str()); return; }
+    std::ofstream out(path, std::ios::binary);
+    out << stem_mode_name(m) << "\n";
+}
+
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <string>
+#include "../mystl/vector.hpp"
+#include "tokenize.hpp"
+
+namespace ir {
+
+inline char tolower_ascii(char c) {
+    if (c >= 'A' && c <= 'Z') return (char)(c - 'A' + 'a');
+    return c;
+}
+
+inline bool is_word_char(char c) {
+    return (char_class(c) & CC_ALNUM) != 0;
+}
+
+void tokenize_line(const std::string& line, mystl::Vector<std::string>& out_tokens);
+
+bool ends_with(const std::string& s, const char* suf);
+
+// Shared by indexing and query parsing, so both sides always agree on terms.
+// The light stemmer is the default; an index built with another one records it
+// (stemmer.txt), and queries against it are stemmed the same way.
+enum StemMode : uint8_t { STEM_LIGHT = 0, STEM_PORTER = 1 };
+
+void stem_inplace(std::string& w);
+void porter_stem_inplace(std::string& w);
+
+inline void stem_inplace(std::string& w, StemMode m) {
+    if (m == STEM_PORTER) porter_stem_inplace(w);
+    else stem_inplace(w);
+}
+
+bool parse_stem_mode(const std::string& name, StemMode& out);
+const char* stem_mode_name(StemMode m);
+
+// stemmer.txt in an index directory names its stemmer; without it the index is light.
+// read_stem_mode fails only on a name it does not know.
+bool read_stem_mode(const std::string& index_dir, StemMode& out);
+void write_stem_mode(const std::string& index_dir, StemMode m);
+
+}
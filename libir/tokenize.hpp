@@ -0,0 +1,133 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace ir {
+
+// Byte classes for the tokenizer. Only ASCII letters and digits count as alnum,
+// which is what std::isalnum gives in the "C" locale the tools run under.
+enum : uint8_t { CC_ALNUM = 1, CC_JOIN = 2, CC_UPPER = 4 };
+
+struct CharClassTable {
+    uint8_t v[256];
+    constexpr CharClassTable() : v() {
+        for (int c = '0'; c <= '9'; ++c) v[c] = CC_ALNUM;
+        for (int c = 'a'; c <= 'z'; ++c) v[c] = CC_ALNUM;
+        for (int c = 'A'; c <= 'Z'; ++c) v[c] = CC_ALNUM | CC_UPPER;
+        v[(unsigned char)'-'] = CC_JOIN;
+        v[(unsigned char)'\''] = CC_JOIN;
+    }
+};
+
+inline constexpr CharClassTable CHAR_CLASS{};
+
+inline uint8_t char_class(char c) { return CHAR_CLASS.v[(unsigned char)c]; }
+
+#if defined(__SSE2__)
+// Mask of bytes with lo <= c <= hi (unsigned).
+inline __m128i sse_in_range(__m128i x, char lo, char hi) {
+    __m128i d = _mm_sub_epi8(x, _mm_set1_epi8(lo));
+    return _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8((char)(hi - lo))), d);
+}
+
+inline __m128i sse_alnum(__m128i x) {
+    __m128i folded = _mm_or_si128(x, _mm_set1_epi8(0x20));
+    return _mm_or_si128(sse_in_range(x, '0', '9'), sse_in_range(folded, 'a', 'z'));
+}
+#endif
+
+// Lowercases ASCII letters of src[0..n) into dst.
+inline void lower_ascii_copy(const char* src, size_t n, char* dst) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 16 <= n; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i up = _mm_and_si128(sse_in_range(x, 'A', 'Z'), _mm_set1_epi8(0x20));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(x, up));
+    }
+#endif
+    for (; i < n; ++i) dst[i] = (char)(src[i] | ((char_class(src[i]) & CC_UPPER) ? 0x20 : 0));
+}
+
+// Yields lowercase tokens straight out of a byte buffer (e.g. an mmapped file).
+// A token without uppercase letters points into the buffer itself; otherwise it is
+// lowercased into an internal scratch string. Either view is valid until the next call.
+// With SSE2 the delimiter runs and token bodies are scanned 16 bytes at a time;
+// the table-driven loops handle the tail and other targets.
+class TokenStream {
+public:
+    TokenStream(const char* data, size_t n) : p_(data), end_(data + n) { scratch_.reserve(64); }
+
+    bool next(std::string_view& tok) {
+        while (p_ < end_) {
+            skip_delims();
+            const char* s = p_;
+            bool upper = scan_token();
+            size_t n = (size_t)(p_ - s);
+            if (n < 2) continue;
+            if (!upper) {
+                tok = std::string_view(s, n);
+                return true;
+            }
+            scratch_.resize(n);
+            lower_ascii_copy(s, n, &scratch_[0]);
+            tok = std::string_view(scratch_.data(), n);
+            return true;
+        }
+        return false;
+    }
+
+private:
+    void skip_delims() {
+#if defined(__SSE2__)
+        while (p_ + 16 <= end_) {
+            __m128i x = _mm_loadu_si128((const __m128i*)p_);
+            unsigned m = (unsigned)_mm_movemask_epi8(sse_alnum(x));
+            if (m) { p_ += __builtin_ctz(m); return; }
+            p_ += 16;
+        }
+#endif
+        while (p_ < end_ && !(char_class(*p_) & CC_ALNUM)) ++p_;
+    }
+
+    // Advances past the token body starting at p_; returns whether it had uppercase letters.
+    bool scan_token() {
+        bool upper = false;
+#if defined(__SSE2__)
+        while (p_ + 16 <= end_) {
+            __m128i x = _mm_loadu_si128((const __m128i*)p_);
+            __m128i word = _mm_or_si128(sse_alnum(x),
+                           _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('-')),
+                                        _mm_cmpeq_epi8(x, _mm_set1_epi8('\''))));
+            unsigned stop = ~(unsigned)_mm_movemask_epi8(word) & 0xFFFFu;
+            unsigned ups = (unsigned)_mm_movemask_epi8(sse_in_range(x, 'A', 'Z'));
+            if (stop) {
+                unsigned len = (unsigned)__builtin_ctz(stop);
+                upper |= (ups & ((1u << len) - 1)) != 0;
+                p_ += len;
+                return upper;
+            }
+            upper |= ups != 0;
+            p_ += 16;
+        }
+#endif
+        while (p_ < end_) {
+            uint8_t k = char_class(*p_);
+            if (!k) break;
+            upper |= (k & CC_UPPER) != 0;
+            ++p_;
+        }
+        return upper;
+    }
+
+    const char* p_;
+    const char* end_;
+    std::string scratch_;
+};
+
+}
@@ -2,6 +2,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <string>
+#include <string_view>
 #include <utility>
 #include "vector.hpp"
 
@@ -33,14 +34,22 @@ public:
 
     HashMap() : size_(0), tombs_(0) { rehash(1024); }
 
+    // Sized once for n keys, so a bulk load never rehashes.
+    explicit HashMap(size_t n) : size_(0), tombs_(0) { rehash(capacity_for(n)); }
+
+    void reserve(size_t n) {
+        size_t cap = capacity_for(n);
+        if (cap > buckets_.size()) rehash(cap);
+    }
+
     size_t size() const { return size_; }
 
     Bucket* buckets() { return buckets_.data(); }
     const Bucket* buckets() const { return buckets_.data(); }
     size_t bucket_count() const { return buckets_.size(); }
 
-    V* find(const std::string& key) {
-        uint64_t h = hash_str(key);
+    V* find(std::string_view key) {
+        uint64_t h = fnv1a_64(key.data(), key.size());
         size_t m = buckets_.size();
         size_t idx = (size_t)(h % m);
 
@@ -56,13 +65,13 @@ public:
         return nullptr;
     }
 
-    const V* find(const std::string& key) const {
+    const V* find(std::string_view key) const {
         return const_cast<HashMap*>(this)->find(key);
     }
 
-    V& get_or_insert(const std::string& key, const V& default_value) {
+    V& get_or_insert(std::string_view key, const V& default_value) {
         maybe_grow();
-        uint64_t h = hash_str(key);
+        uint64_t h = fnv1a_64(key.data(), key.size());
         size_t m = buckets_.size();
         size_t idx = (size_t)(h % m);
         size_t first_tomb = (size_t)-1;
@@ -93,11 +102,40 @@ public:
         return get_or_insert(key, default_value);
     }
 
+    bool erase(std::string_view key) {
+        uint64_t h = fnv1a_64(key.data(), key.size());
+        size_t m = buckets_.size();
+        size_t idx = (size_t)(h % m);
+
+        for (size_t step = 0; step < m; ++step) {
+            Bucket& b = buckets_[idx];
+            if (!b.used) {
+                if (!b.tomb) return false;
+            } else if (b.h == h && b.key == key) {
+                b.used = false;
+                b.tomb = true;
+                b.key.clear();
+                b.value = V();
+                --size_;
+                ++tombs_;
+                return true;
+            }
+            idx = (idx + 1) % m;
+        }
+        return false;
+    }
+
 private:
+    static size_t capacity_for(size_t n) {
+        size_t cap = 1024;
+        while ((double)n / (double)cap > 0.70) cap *= 2;
+        return cap;
+    }
+
     void maybe_grow() {
         size_t m = buckets_.size();
         double load = (double)(size_ + tombs_) / (double)m;
-        if (load > 0.70) rehash(m * 2);
+        if (load > 0.70) rehash((double)size_ / (double)m > 0.35 ? m * 2 : m);
     }
 
     void rehash(size_t new_cap) {
@@ -0,0 +1,162 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "vector.hpp"
+#include "hashmap.hpp"
+#include "string_arena.hpp"
+
+namespace mystl {
+
+// HashMap variant whose keys are interned into a StringArena. A bucket only
+// holds (offset, length) and the value, so inserts do no per-key allocation.
+//
+// Layout is Swiss-table style: power-of-two capacity split into groups of 16
+// slots, plus a dense control byte per slot (CTRL_EMPTY or the low 7 hash bits).
+// A probe compares a whole group of control bytes at once and only touches a
+// bucket when its hash fragment matches.
+template <typename V>
+class InternMap {
+public:
+    struct Bucket {
+        uint32_t off = 0;
+        uint32_t len = 0;
+        V value;
+    };
+
+    static const uint8_t CTRL_EMPTY = 0x80;
+    static const size_t GROUP = 16;
+
+    InternMap() : size_(0) { rehash(1024); }
+
+    // Sized once for n keys, so a bulk load never rehashes.
+    explicit InternMap(size_t n, size_t key_bytes = 0) : size_(0) {
+        rehash(capacity_for(n));
+        pool_.reserve(key_bytes);
+    }
+
+    void reserve(size_t n, size_t key_bytes = 0) {
+        size_t cap = capacity_for(n);
+        if (cap > buckets_.size()) rehash(cap);
+        pool_.reserve(key_bytes);
+    }
+
+    size_t size() const { return size_; }
+
+    Bucket* buckets() { return buckets_.data(); }
+    const Bucket* buckets() const { return buckets_.data(); }
+    size_t bucket_count() const { return buckets_.size(); }
+    bool used(size_t i) const { return ctrl_[i] != CTRL_EMPTY; }
+
+    std::string_view key(const Bucket& b) const { return pool_.view(b.off, b.len); }
+    size_t pool_bytes() const { return pool_.size(); }
+
+    V* find(std::string_view key) {
+        uint64_t h = fnv1a_64(key.data(), key.size());
+        size_t gmask = (buckets_.size() / GROUP) - 1;
+        size_t g = (size_t)(h >> 7) & gmask;
+        uint8_t h2 = (uint8_t)(h & 0x7F);
+
+        for (size_t step = 0; step <= gmask; ++step) {
+            const uint8_t* c = ctrl_.data() + g * GROUP;
+            for (unsigned m = match(c, h2); m; m &= m - 1) {
+                Bucket& b = buckets_[g * GROUP + (size_t)__builtin_ctz(m)];
+                if (pool_.view(b.off, b.len) == key) return &b.value;
+            }
+            if (match(c, CTRL_EMPTY)) return nullptr;
+            g = (g + step + 1) & gmask;
+        }
+        return nullptr;
+    }
+
+    const V* find(std::string_view key) const {
+        return const_cast<InternMap*>(this)->find(key);
+    }
+
+    V& get_or_insert(std::string_view key, const V& default_value) {
+        if ((size_ + 1) * 8 > buckets_.size() * 7) rehash(buckets_.size() * 2);
+        uint64_t h = fnv1a_64(key.data(), key.size());
+        size_t gmask = (buckets_.size() / GROUP) - 1;
+        size_t g = (size_t)(h >> 7) & gmask;
+        uint8_t h2 = (uint8_t)(h & 0x7F);
+
+        for (size_t step = 0;; ++step) {
+            const uint8_t* c = ctrl_.data() + g * GROUP;
+            for (unsigned m = match(c, h2); m; m &= m - 1) {
+                Bucket& b = buckets_[g * GROUP + (size_t)__builtin_ctz(m)];
+                if (pool_.view(b.off, b.len) == key) return b.value;
+            }
+            unsigned e = match(c, CTRL_EMPTY);
+            if (e) {
+                size_t i = g * GROUP + (size_t)__builtin_ctz(e);
+                ctrl_[i] = h2;
+                Bucket& b = buckets_[i];
+                b.off = pool_.add(key.data(), key.size());
+                b.len = (uint32_t)key.size();
+                b.value = default_value;
+                ++size_;
+                return b.value;
+            }
+            g = (g + step + 1) & gmask;
+        }
+    }
+
+private:
+    static size_t capacity_for(size_t n) {
+        size_t cap = 1024;
+        while (n * 8 > cap * 7) cap *= 2;
+        return cap;
+    }
+
+    static unsigned match(const uint8_t* c, uint8_t v) {
+#if defined(__SSE2__)
+        __m128i x = _mm_loadu_si128((const __m128i*)c);
+        return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8((char)v)));
+#else
+        unsigned m = 0;
+        for (size_t i = 0; i < GROUP; ++i) m |= (unsigned)(c[i] == v) << i;
+        return m;
+#endif
+    }
+
+    void rehash(size_t new_cap) {
+        mystl::Vector<Bucket> old = std::move(buckets_);
+        mystl::Vector<uint8_t> old_ctrl = std::move(ctrl_);
+        buckets_.clear();
+        buckets_.reserve(new_cap);
+        ctrl_.reserve(new_cap);
+        for (size_t i = 0; i < new_cap; ++i) {
+            buckets_.emplace_back();
+            ctrl_.push_back(CTRL_EMPTY);
+        }
+
+        size_t gmask = (new_cap / GROUP) - 1;
+        for (size_t i = 0; i < old.size(); ++i) {
+            if (old_ctrl[i] == CTRL_EMPTY) continue;
+            Bucket& src = old[i];
+            uint64_t h = fnv1a_64(pool_.view(src.off, src.len).data(), src.len);
+            size_t g = (size_t)(h >> 7) & gmask;
+            for (size_t step = 0;; ++step) {
+                unsigned e = match(ctrl_.data() + g * GROUP, CTRL_EMPTY);
+                if (e) {
+                    size_t j = g * GROUP + (size_t)__builtin_ctz(e);
+                    ctrl_[j] = (uint8_t)(h & 0x7F);
+                    buckets_[j] = std::move(src);
+                    break;
+                }
+                g = (g + step + 1) & gmask;
+            }
+        }
+    }
+
+    mystl::Vector<Bucket> buckets_;
+    mystl::Vector<uint8_t> ctrl_;
+    StringArena pool_;
+    size_t size_;
+};
+
+}
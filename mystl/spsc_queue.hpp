@@ -0,0 +1,52 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <type_traits>
+#include "vector.hpp"
+
+namespace mystl {
+
+// Bounded single-producer single-consumer ring. The producer only writes tail_
+// and the consumer only writes head_, each with release/acquire ordering, so
+// neither side takes a lock. Capacity is rounded up to a power of two; one
+// slot is never used, so a full and an empty ring look different.
+template <typename T>
+class SpscQueue {
+    static_assert(std::is_trivially_copyable<T>::value, "SpscQueue holds trivially copyable values");
+
+public:
+    explicit SpscQueue(size_t capacity) : head_(0), tail_(0) {
+        size_t n = 2;
+        while (n < capacity + 1) n *= 2;
+        slots_.resize(n);
+        mask_ = n - 1;
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    bool try_push(const T& v) {
+        size_t t = tail_.load(std::memory_order_relaxed);
+        size_t next = (t + 1) & mask_;
+        if (next == head_.load(std::memory_order_acquire)) return false;
+        slots_[t] = v;
+        tail_.store(next, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T& out) {
+        size_t h = head_.load(std::memory_order_relaxed);
+        if (h == tail_.load(std::memory_order_acquire)) return false;
+        out = slots_[h];
+        head_.store((h + 1) & mask_, std::memory_order_release);
+        return true;
+    }
+
+private:
+    Vector<T> slots_;
+    size_t mask_;
+    alignas(64) std::atomic<size_t> head_;
+    alignas(64) std::atomic<size_t> tail_;
+};
+
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <new>
+
+namespace mystl {
+
+// Append-only pool of string bytes. Strings are referred to by offset, so the
+// pool can grow (and be moved) without invalidating handles.
+class StringArena {
+public:
+    StringArena() : data_(nullptr), size_(0), cap_(0) {}
+
+    StringArena(const StringArena&) = delete;
+    StringArena& operator=(const StringArena&) = delete;
+
+    StringArena(StringArena&& other) noexcept : data_(other.data_), size_(other.size_), cap_(other.cap_) {
+        other.data_ = nullptr;
+        other.size_ = 0;
+        other.cap_ = 0;
+    }
+
+    StringArena& operator=(StringArena&& other) noexcept {
+        if (this == &other) return *this;
+        ::operator delete(data_);
+        data_ = other.data_;
+        size_ = other.size_;
+        cap_ = other.cap_;
+        other.data_ = nullptr;
+        other.size_ = 0;
+        other.cap_ = 0;
+        return *this;
+    }
+
+    ~StringArena() { ::operator delete(data_); }
+
+    uint32_t add(const char* s, size_t n) {
+        if (size_ + n > cap_) grow(size_ + n);
+        std::memcpy(data_ + size_, s, n);
+        uint32_t off = (uint32_t)size_;
+        size_ += n;
+        return off;
+    }
+
+    void reserve(size_t n) {
+        if (n > cap_) grow(n);
+    }
+
+    std::string_view view(uint32_t off, uint32_t len) const { return std::string_view(data_ + off, len); }
+
+    size_t size() const { return size_; }
+
+private:
+    void grow(size_t need) {
+        size_t new_cap = cap_ ? cap_ * 2 : 4096;
+        while (new_cap < need) new_cap *= 2;
+        char* p = static_cast<char*>(::operator new(new_cap));
+        if (size_) std::memcpy(p, data_, size_);
+        ::operator delete(data_);
+        data_ = p;
+        cap_ = new_cap;
+    }
+
+    char* data_;
+    size_t size_;
+    size_t cap_;
+};
+
+}
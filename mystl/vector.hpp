@@ -1,25 +1,29 @@
 #pragma once
 #include <cstddef>
+#include <cstdlib>
+#include <cstring>
 #include <utility>
 #include <new>
+#include <type_traits>
 
 namespace mystl {
 
+// Trivially copyable element types live in malloc'ed storage and are relocated
+// with realloc/memcpy; everything else is moved element by element.
 template <typename T>
 class Vector {
+    static constexpr bool TRIVIAL = std::is_trivially_copyable<T>::value;
+
 public:
     Vector() : data_(nullptr), size_(0), cap_(0) {}
 
     Vector(const Vector& other) : data_(nullptr), size_(0), cap_(0) {
-        reserve(other.size_);
-        for (size_t i = 0; i < other.size_; ++i) push_back(other[i]);
+        assign(other.data_, other.size_);
     }
 
     Vector& operator=(const Vector& other) {
         if (this == &other) return *this;
-        clear();
-        reserve(other.size_);
-        for (size_t i = 0; i < other.size_; ++i) push_back(other[i]);
+        assign(other.data_, other.size_);
         return *this;
     }
 
@@ -46,31 +50,52 @@ public:
 
     void reserve(size_t new_cap) {
         if (new_cap <= cap_) return;
-        T* new_data = static_cast<T*>(::operator new(sizeof(T) * new_cap));
-        for (size_t i = 0; i < size_; ++i) {
-            new (&new_data[i]) T(std::move(data_[i]));
-            data_[i].~T();
+        relocate(new_cap);
+    }
+
+    // Releases the slack left by geometric growth.
+    void shrink_to_fit() {
+        if (size_ == cap_) return;
+        if (size_ == 0) { destroy_storage(); return; }
+        relocate(size_);
+    }
+
+    void resize(size_t n) {
+        if (n > cap_) reserve(n);
+        if (n > size_) {
+            for (size_t i = size_; i < n; ++i) new (&data_[i]) T();
+        } else {
+            for (size_t i = n; i < size_; ++i) data_[i].~T();
         }
-        ::operator delete(data_);
-        data_ = new_data;
-        cap_ = new_cap;
+        size_ = n;
+    }
+
+    void assign(const T* p, size_t n) {
+        clear();
+        reserve(n);
+        if constexpr (TRIVIAL) {
+            if (n) std::memcpy((void*)data_, (const void*)p, sizeof(T) * n);
+        } else {
+            for (size_t i = 0; i < n; ++i) new (&data_[i]) T(p[i]);
+        }
+        size_ = n;
     }
 
     void push_back(const T& v) {
-        if (size_ == cap_) reserve(cap_ ? cap_ * 2 : 8);
+        if (size_ == cap_) reserve(grow_cap());
         new (&data_[size_]) T(v);
         ++size_;
     }
 
     void push_back(T&& v) {
-        if (size_ == cap_) reserve(cap_ ? cap_ * 2 : 8);
+        if (size_ == cap_) reserve(grow_cap());
         new (&data_[size_]) T(std::move(v));
         ++size_;
     }
 
     template <class... Args>
     T& emplace_back(Args&&... args) {
-        if (size_ == cap_) reserve(cap_ ? cap_ * 2 : 8);
+        if (size_ == cap_) reserve(grow_cap());
         new (&data_[size_]) T(std::forward<Args>(args)...);
         ++size_;
         return data_[size_ - 1];
@@ -83,11 +108,12 @@ public:
     }
 
     void clear() {
-        for (size_t i = 0; i < size_; ++i) data_[i].~T();
+        if constexpr (!TRIVIAL) for (size_t i = 0; i < size_; ++i) data_[i].~T();
         size_ = 0;
     }
 
     size_t size() const { return size_; }
+    size_t capacity() const { return cap_; }
     bool empty() const { return size_ == 0; }
 
     T& operator[](size_t i) { return data_[i]; }
@@ -97,9 +123,30 @@ public:
     const T* data() const { return data_; }
 
 private:
+    // 1.5x growth keeps worst-case slack of long-lived lists at a third.
+    size_t grow_cap() const { return cap_ ? cap_ + cap_ / 2 + 1 : 8; }
+
+    void relocate(size_t new_cap) {
+        if constexpr (TRIVIAL) {
+            void* p = std::realloc((void*)data_, sizeof(T) * new_cap);
+            if (!p) throw std::bad_alloc();
+            data_ = static_cast<T*>(p);
+        } else {
+            T* new_data = static_cast<T*>(::operator new(sizeof(T) * new_cap));
+            for (size_t i = 0; i < size_; ++i) {
+                new (&new_data[i]) T(std::move(data_[i]));
+                data_[i].~T();
+            }
+            ::operator delete(data_);
+            data_ = new_data;
+        }
+        cap_ = new_cap;
+    }
+
     void destroy_storage() {
         clear();
-        ::operator delete(data_);
+        if constexpr (TRIVIAL) std::free((void*)data_);
+        else ::operator delete(data_);
         data_ = nullptr;
         cap_ = 0;
     }
@@ -0,0 +1,172 @@
+#!/bin/bash
+# make check: indexes one fixed corpus (tests/make_corpus.py) in every build
+# mode and compares the answers to tests/queries.txt with those of the
+# default build. Answers are compared as sets of "source/file" names (plus
+# scores for BM25), so modes that renumber documents compare too.
+# CHECK_DOCS sets the corpus size; CHECK_KEEP=1 keeps the work directory.
+set -u
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+BI=$ROOT/lab7/boolindex.exe
+BS=$ROOT/lab8/boolsearch.exe
+QUERIES=$ROOT/tests/queries.txt
+DOCS=${CHECK_DOCS:-1500}
+W=$(mktemp -d "${TMPDIR:-/tmp}/ircheck.XXXXXX")
+PIDS=()
+FAILED=0
+PASSED=0
+
+cleanup() {
+    for p in "${PIDS[@]+"${PIDS[@]}"}"; do kill "$p" 2>/dev/null; done
+    wait 2>/dev/null
+    if [ -n "${CHECK_KEEP:-}" ]; then echo "kept $W"; else rm -rf "$W"; fi
+}
+trap cleanup EXIT
+
+python3 "$ROOT/tests/make_corpus.py" "$W/corpus" 0 "$DOCS" || exit 2
+
+# build <name> <input_dir> [boolindex args]: index into $W/<name>/index.
+build() {
+    local name=$1 input=$2
+    shift 2
+    if ! "$BI" --input_dir "$input" --out_dir "$W/$name" "$@" > "$W/$name.log" 2>&1; then
+        echo "FAIL build $name: boolindex $*"
+        sed 's/^/  /' "$W/$name.log" | head -5
+        FAILED=$((FAILED + 1))
+    fi
+}
+
+# answers <out> [boolsearch args]: every query in batch mode, normalized.
+answers() {
+    local out=$1
+    shift
+    "$BS" --queries "$QUERIES" --cache_mb 0 --topk 100000 "$@" 2>/dev/null | awk -F'\t' '
+        /^(OK|ERR) / { q++; print q "\t" $0; next }
+        {
+            n = split($2, p, "/")
+            line = q "\t~" p[n - 1] "/" p[n]
+            if (NF > 2) line = line "\t" $3
+            print line
+        }' | LC_ALL=C sort > "$out"
+}
+
+# expect <name> <reference> [boolsearch args]: the answers must match the reference.
+expect() {
+    local name=$1 ref=$2
+    shift 2
+    answers "$W/$name.out" "$@"
+    if [ ! -s "$W/$name.out" ] || ! cmp -s "$W/$ref" "$W/$name.out"; then
+        echo "FAIL $name"
+        diff "$W/$ref" "$W/$name.out" | head -5 | sed 's/^/  /'
+        FAILED=$((FAILED + 1))
+    else
+        PASSED=$((PASSED + 1))
+    fi
+}
+
+# expect_both <name> [boolsearch args]: exact answers and BM25 rankings.
+expect_both() {
+    local name=$1
+    shift
+    expect "$name" "$REF.exact" --index_dir "$W/$name/index" "$@"
+    expect "$name.bm25" "$REF.bm25" --index_dir "$W/$name/index" --rank bm25 "$@"
+}
+
+# reference <name>: answers of an already built index become the reference.
+reference() {
+    REF=$1
+    answers "$W/$REF.exact" --index_dir "$W/$REF/index"
+    answers "$W/$REF.bm25" --index_dir "$W/$REF/index" --rank bm25
+    if [ ! -s "$W/$REF.exact" ] || [ ! -s "$W/$REF.bm25" ]; then
+        echo "FAIL reference $REF has no answers"
+        exit 1
+    fi
+}
+
+# grow <name> [boolindex args]: two thirds of the corpus, then the rest with --append.
+grow() {
+    local name=$1 split=$((DOCS * 2 / 3))
+    shift
+    python3 "$ROOT/tests/make_corpus.py" "$W/$name.docs" 0 "$split"
+    build "$name" "$W/$name.docs" "$@"
+    python3 "$ROOT/tests/make_corpus.py" "$W/$name.docs" "$split" "$DOCS"
+    build "$name" "$W/$name.docs" --append
+}
+
+build default "$W/corpus"
+reference default
+
+build bp128 "$W/corpus" --codec bp128
+expect_both bp128
+
+build threads "$W/corpus" --threads 4
+expect_both threads
+
+build spimi "$W/corpus" --mem_mb 1 --threads 3
+expect_both spimi
+
+grow delta
+expect_both delta
+build delta "$W/corpus" --compact
+expect_both delta
+
+build reorder_path "$W/corpus" --reorder path
+expect_both reorder_path
+build reorder_bp "$W/corpus" --reorder bp --threads 2
+expect_both reorder_bp
+
+build shards_range "$W/corpus" --shards 3
+expect_both shards_range
+build shards_hash "$W/corpus" --shards 4 --shard_by hash --codec bp128
+expect_both shards_hash
+grow shards_grow --shards 3 --shard_by hash
+expect_both shards_grow
+
+# Remote shards: each hash shard behind its own boolsearch --serve.
+remotes=()
+for s in 0 1 2 3; do
+    sock=$W/shard_$s.sock
+    "$BS" --index_dir "$W/shards_hash/index/shard_00$s" --serve --socket "$sock" > /dev/null 2>&1 &
+    PIDS+=($!)
+    for _ in $(seq 50); do [ -S "$sock" ] && break; sleep 0.1; done
+    remotes+=(--remote "unix:$sock")
+done
+expect remote "$REF.exact" "${remotes[@]}"
+if "$BS" "${remotes[@]}" --rank bm25 --query ship > /dev/null 2>&1; then
+    echo "FAIL remote: a BM25 coordinator accepted boolean shards"
+    FAILED=$((FAILED + 1))
+else
+    PASSED=$((PASSED + 1))
+fi
+
+build pipeline "$W/corpus" --pipeline --threads 2
+expect_both pipeline
+build pipeline_spimi "$W/corpus" --pipeline --mem_mb 1
+expect_both pipeline_spimi
+
+# A light rebuild over a Porter index must answer like the default build again.
+build stemmer "$W/corpus" --stemmer porter
+build stemmer "$W/corpus"
+expect_both stemmer
+
+# Phrases and NEAR are only exact with pos.bin, so positional builds get their own reference.
+build positions "$W/corpus" --positions
+reference positions
+build positions_bp128 "$W/corpus" --positions --codec bp128
+expect_both positions_bp128
+build positions_spimi "$W/corpus" --positions --mem_mb 1 --threads 3
+expect_both positions_spimi
+grow positions_delta --positions
+expect_both positions_delta
+build positions_delta "$W/corpus" --compact
+expect_both positions_delta
+build positions_reorder "$W/corpus" --positions --reorder bp
+expect_both positions_reorder
+build positions_shards "$W/corpus" --positions --shards 3 --shard_by hash
+expect_both positions_shards
+
+if [ "$FAILED" -ne 0 ]; then
+    echo "check: $FAILED failed, $PASSED passed"
+    exit 1
+fi
+echo "check: $PASSED passed"
@@ -0,0 +1,48 @@
+import os
+import random
+import sys
+
+# Fixed synthetic corpus for make check. Document k depends only on k, so any
+# range of it can be written separately (the --append checks grow a copy).
+# Zipf-distributed words give dense terms (bitmaps), lists longer than a skip
+# block and rare terms; inflected forms exercise the stemmer, and a few
+# documents are empty.
+
+WORDS = ("ship ships shipping shipped vessel vessels port ports harbor cargo crew tanker container "
+         "ocean sea marine naval navy fleet captain engine diesel fishing coast guard nation nations "
+         "station running quickly development government oil gas wind research").split()
+VOCAB = WORDS + ["w%d" % i for i in range(3000)]
+WEIGHTS = [1.0 / (i + 1) for i in range(len(VOCAB))]
+SOURCES = ("wikipedia_en", "marinelink")
+
+
+def write_doc(out_dir, k):
+    rng = random.Random(1000003 * k + 17)
+    src = SOURCES[k % 2]
+    d = os.path.join(out_dir, src)
+    os.makedirs(d, exist_ok=True)
+    path = os.path.join(d, "%s_%05d.txt" % (src, k))
+    if k % 97 == 13:
+        open(path, "w").close()
+        return
+    words = rng.choices(VOCAB, WEIGHTS, k=rng.randint(20, 400))
+    lines = []
+    for i in range(0, len(words), 10):
+        seg = [w.capitalize() if rng.random() < 0.1 else w for w in words[i:i + 10]]
+        if rng.random() < 0.2:
+            seg.append("it's")
+        lines.append(" ".join(seg) + ".")
+    with open(path, "w") as f:
+        f.write("\n".join(lines) + "\n")
+
+
+def main():
+    if len(sys.argv) != 4:
+        sys.exit("usage: make_corpus.py out_dir first last")
+    out_dir, first, last = sys.argv[1], int(sys.argv[2]), int(sys.argv[3])
+    for k in range(first, last):
+        write_doc(out_dir, k)
+
+
+if __name__ == "__main__":
+    main()